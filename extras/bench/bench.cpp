@@ -0,0 +1,319 @@
+/**
+ * Host benchmarks of PostgrestClient against fakeserver (see README.md).
+ * Every workload runs a number of iterations in a connection mode (a new connection per request,
+ * or keep-alive) and reports per request: throughput, p50/p99 latency, bytes on the wire,
+ * write() calls, connections and heap allocations.
+ *
+ * usage: bench [-p port] [-v vendor] [-n iterations] [-w workloads] [-m mode] [-z] [-c]
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <PostgrestClient.h>
+#include <algorithm>
+#include <unistd.h>
+#include <vector>
+#include "heapcount.h"
+
+namespace
+{
+
+const char *const EMAIL = "sensor@example.com";
+const char *const PASSWORD = "benchmark-password";
+
+struct Settings
+{
+    const char *host = "127.0.0.1";
+    uint16_t port = 8431;
+    const char *vendor = "neon";
+    unsigned long iterations = 1000;
+    const char *workloads = "signin,get,get100,rows,post,rpc,batch";
+    const char *mode = "both"; // "close", "keepalive" or "both"
+    bool compression = false;
+    bool csv = false;
+};
+
+Settings settings;
+
+// one request (or batch flush) of a workload, nullptr on success
+typedef const char *(*Workload)(PostgrestClient &client);
+
+const char *signIn(PostgrestClient &client)
+{
+    return client.signIn(EMAIL, PASSWORD);
+}
+
+const char *get10(PostgrestClient &client)
+{
+    return client.doGet("/sensorvalues?select=id,sensor_name,sensor_value,created_at&order=id.desc&limit=10");
+}
+
+const char *get100(PostgrestClient &client)
+{
+    return client.doGet("/sensorvalues?select=id,sensor_name,sensor_value,created_at&order=id.desc&limit=100");
+}
+
+const char *rows100(PostgrestClient &client)
+{
+    const char *error = client.beginRows("/sensorvalues?select=id,sensor_name,sensor_value,created_at&limit=100");
+    long sum = 0;
+    while (!error && client.nextRow())
+        sum += client.getJsonResult()["id"].as<long>();
+    error = client.endRows();
+    return error ? error : (sum == 5050 ? nullptr : "rows missing");
+}
+
+// five small tables as loaded at boot, one request after the other or pipelined
+const char *const CONFIG_ROUTES[] = {
+    "/sensorvalues?select=id,sensor_name&limit=5",
+    "/sensorvalues?select=id,sensor_value&limit=5&offset=5",
+    "/sensorvalues?select=id,created_at&limit=5&offset=10",
+    "/sensorvalues?select=id&limit=5&offset=15",
+    "/sensorvalues?select=sensor_name&limit=5&offset=20",
+};
+const size_t CONFIG_COUNT = sizeof(CONFIG_ROUTES) / sizeof(CONFIG_ROUTES[0]);
+
+const char *configs(PostgrestClient &client)
+{
+    for (size_t i = 0; i < CONFIG_COUNT; i++)
+    {
+        const char *error = client.doGet(CONFIG_ROUTES[i]);
+        if (error)
+            return error;
+    }
+    return nullptr;
+}
+
+const char *configsPipelined(PostgrestClient &client)
+{
+    static JsonDocument results[CONFIG_COUNT];
+    PostgrestPipelinedGet gets[CONFIG_COUNT];
+    for (size_t i = 0; i < CONFIG_COUNT; i++)
+        gets[i] = PostgrestPipelinedGet(CONFIG_ROUTES[i], &results[i]);
+    return client.doGetPipelined(gets, CONFIG_COUNT);
+}
+
+void fillRow(JsonDocument &row, int i)
+{
+    row["sensor_name"] = "temperature";
+    row["sensor_value"] = 20.0 + i * 0.1;
+}
+
+const char *post(PostgrestClient &client)
+{
+    fillRow(client.getJsonRequest(), 1);
+    return client.doPost("/sensorvalues");
+}
+
+const char *rpc(PostgrestClient &client)
+{
+    JsonDocument &args = client.getJsonRequest();
+    args["sensor"] = "temperature";
+    args["since"] = "2025-01-01T00:00:00Z";
+    const char *error = client.doPostRPC("/rpc/sensor_stats");
+    if (!error && !client.getJsonResult()["count"].is<long>())
+        return "unexpected RPC result";
+    return error;
+}
+
+const char *batch50(PostgrestClient &client)
+{
+    static PostgrestBatch<4096> *batch = nullptr;
+    if (!batch)
+        batch = new PostgrestBatch<4096>(client, "/sensorvalues", 100, 0); // flushed below, not by add()
+    for (int i = 0; i < 50; i++)
+    {
+        fillRow(client.getJsonRequest(), i);
+        const char *error = batch->add();
+        if (error)
+            return error;
+    }
+    return batch->flush();
+}
+
+struct Entry
+{
+    const char *name;
+    Workload run;
+};
+
+const Entry workloads[] = {
+    {"signin", signIn},
+    {"get", get10},
+    {"get100", get100},
+    {"rows", rows100},
+    {"post", post},
+    {"rpc", rpc},
+    {"batch", batch50},
+    {"configs", configs},
+    {"pipelined", configsPipelined},
+};
+
+bool selected(const char *list, const char *name)
+{
+    size_t length = strlen(name);
+    for (const char *p = list; p && *p;)
+    {
+        const char *end = strchr(p, ',');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        if (n == length && strncmp(p, name, n) == 0)
+            return true;
+        p = end ? end + 1 : nullptr;
+    }
+    return false;
+}
+
+PostgrestClient *createClient(WiFiClient &connection)
+{
+    if (strcmp(settings.vendor, "neon") == 0)
+        return new NeonPostgrestClient(connection, "auth.bench.local", "/neondb/auth", "api.bench.local", "/neondb/rest/v1");
+    if (strcmp(settings.vendor, "supabase") == 0)
+        return new SupabasePostgrestClient(connection, "bench.supabase.local", "/auth/v1", "bench.supabase.local", "/rest/v1",
+                                           "bench-anon-key");
+    if (strcmp(settings.vendor, "selfhosted") == 0)
+        return new SelfHostedPostgrestClient(connection, "127.0.0.1", "", "127.0.0.1", "", settings.port);
+    return nullptr;
+}
+
+void printHeader()
+{
+    if (settings.csv)
+    {
+        printf("vendor,workload,connection,iterations,errors,requests_per_s,p50_us,p99_us,bytes_sent,bytes_received,"
+               "writes,connects,allocations,heap_bytes,heap_peak\n");
+        return;
+    }
+    printf("vendor %s, %lu iterations per workload, server %s:%u%s\n\n", settings.vendor, settings.iterations,
+           settings.host, settings.port, settings.compression ? ", gzip" : "");
+    printf("%-8s %-9s %9s %8s %8s %8s %8s %6s %5s %6s %8s %8s\n", "workload", "conn", "req/s", "p50 us", "p99 us",
+           "sent B", "recv B", "writes", "conn", "allocs", "heap B", "peak B");
+}
+
+void runWorkload(PostgrestClient &client, const Entry &entry, bool keepAlive)
+{
+    client.setKeepAlive(keepAlive);
+    client.closeConnection();
+
+    // warm up: first connection, lazily allocated buffers
+    unsigned long warmup = settings.iterations < 10 ? settings.iterations : 10;
+    for (unsigned long i = 0; i < warmup; i++)
+        entry.run(client);
+
+    std::vector<unsigned long> latencies;
+    latencies.reserve(settings.iterations);
+    unsigned long errors = 0;
+    const char *firstError = nullptr;
+    WiFiClient::stats().reset();
+    resetHeapStats();
+    unsigned long start = micros();
+    for (unsigned long i = 0; i < settings.iterations; i++)
+    {
+        unsigned long t = micros();
+        const char *error = entry.run(client);
+        latencies.push_back(micros() - t);
+        if (error)
+        {
+            errors++;
+            if (!firstError)
+                firstError = error;
+        }
+    }
+    double seconds = (micros() - start) / 1e6;
+    HeapStats heap = heapStats();
+    WiFiClientStats wire = WiFiClient::stats();
+
+    std::sort(latencies.begin(), latencies.end());
+    double n = (double)settings.iterations;
+    unsigned long p50 = latencies[latencies.size() / 2];
+    unsigned long p99 = latencies[(latencies.size() * 99) / 100 < latencies.size() ? (latencies.size() * 99) / 100 : latencies.size() - 1];
+    const char *mode = keepAlive ? "keepalive" : "close";
+    if (settings.csv)
+    {
+        printf("%s,%s,%s,%lu,%lu,%.1f,%lu,%lu,%.0f,%.0f,%.1f,%.2f,%.1f,%.0f,%zu\n", settings.vendor, entry.name, mode,
+               settings.iterations, errors, n / seconds, p50, p99, wire.bytesSent / n, wire.bytesReceived / n,
+               wire.writes / n, wire.connects / n, heap.allocations / n, heap.bytes / n, heap.peak);
+    }
+    else
+    {
+        printf("%-8s %-9s %9.1f %8lu %8lu %8.0f %8.0f %6.1f %5.2f %6.1f %8.0f %8zu\n", entry.name, mode, n / seconds,
+               p50, p99, wire.bytesSent / n, wire.bytesReceived / n, wire.writes / n, wire.connects / n,
+               heap.allocations / n, heap.bytes / n, heap.peak);
+        if (errors)
+            printf("         %lu errors, first: %s\n", errors, firstError);
+    }
+    fflush(stdout);
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: bench [-p port] [-v vendor] [-n iterations] [-w workloads] [-m mode] [-z] [-c]\n"
+            "  -p port        port of fakeserver on 127.0.0.1 (default 8431)\n"
+            "  -v vendor      neon, supabase or selfhosted (default neon)\n"
+            "  -n iterations  requests per workload (default 1000)\n"
+            "  -w workloads   comma separated, default signin,get,get100,rows,post,rpc,batch\n"
+            "                 (also configs,pipelined)\n"
+            "  -m mode        close, keepalive or both (default both)\n"
+            "  -z             accept gzip responses (start fakeserver with -z)\n"
+            "  -c             CSV output, e.g. to compare against a baseline\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:v:n:w:m:zch")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': settings.port = (uint16_t)atoi(optarg); break;
+        case 'v': settings.vendor = optarg; break;
+        case 'n': settings.iterations = strtoul(optarg, nullptr, 10); break;
+        case 'w': settings.workloads = optarg; break;
+        case 'm': settings.mode = optarg; break;
+        case 'z': settings.compression = true; break;
+        case 'c': settings.csv = true; break;
+        default: usage(); return 2;
+        }
+    }
+    if (settings.iterations == 0)
+    {
+        usage();
+        return 2;
+    }
+
+    WiFiClient::redirect(settings.host, settings.port);
+    WiFiClient connection;
+    PostgrestClient *client = createClient(connection);
+    if (!client)
+    {
+        usage();
+        return 2;
+    }
+    if (settings.compression && !client->setCompression(true))
+    {
+        fprintf(stderr, "bench: no memory for compression\n");
+        return 1;
+    }
+    const char *error = client->signIn(EMAIL, PASSWORD);
+    if (error)
+    {
+        fprintf(stderr, "bench: sign in failed: %s (is fakeserver running on port %u?)\n", error, settings.port);
+        return 1;
+    }
+
+    printHeader();
+    bool close = strcmp(settings.mode, "keepalive") != 0;
+    bool keepAlive = strcmp(settings.mode, "close") != 0;
+    for (const Entry &entry : workloads)
+    {
+        if (!selected(settings.workloads, entry.name))
+            continue;
+        if (close)
+            runWorkload(*client, entry, false);
+        if (keepAlive)
+            runWorkload(*client, entry, true);
+    }
+    delete client;
+    return 0;
+}
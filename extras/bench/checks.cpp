@@ -0,0 +1,248 @@
+/**
+ * Regression checks of PostgrestClient against fakeserver (see README.md).
+ * Connection failures are produced by redirecting the WiFiClient to a port nobody listens on.
+ * The offline queue checks use the POSIX storage with a log file in the working directory.
+ *
+ * usage: checks [-p port]
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <PostgrestClient.h>
+#include <string>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace
+{
+
+const char *const HOST = "127.0.0.1";
+const char *const QUEUE_LOG = "checks-queue.log";
+const uint16_t CLOSED_PORT = 1; // connections are refused
+uint16_t port = 8431;
+int failures = 0;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+// collects what is printed
+class StringPrint : public Print
+{
+public:
+    size_t write(uint8_t c) override
+    {
+        text += (char)c;
+        return 1;
+    }
+
+    std::string text;
+};
+
+void fillRow(JsonDocument &row, int i)
+{
+    row["sensor_name"] = "temperature";
+    row["sensor_value"] = 20 + i;
+}
+
+// a row that does not fit in a full buffer stays with the caller, and is not sent before the retry delay
+void checkBatchFullBufferFailure(PostgrestClient &client)
+{
+    PostgrestBatch<256> batch(client, "/sensorvalues", 100, 0);
+    JsonDocument &row = client.getJsonRequest();
+    fillRow(row, 0);
+    size_t rowBytes = measureJson(row) + 1;
+    while (batch.byteCount() + rowBytes <= 256)
+    {
+        fillRow(row, (int)batch.rowCount());
+        CHECK(!batch.add());
+    }
+    size_t rows = batch.rowCount();
+    CHECK(rows > 0);
+
+    WiFiClient::redirect(HOST, CLOSED_PORT);
+    fillRow(row, 100);
+    CHECK(batch.add() != nullptr);
+    CHECK(batch.rowCount() == rows);
+    CHECK(row["sensor_value"].as<int>() == 120); // not cleared
+
+    // the server is back, but the retry delay (1 s after the first failure) is not over
+    WiFiClient::redirect(HOST, port);
+    WiFiClient::stats().reset();
+    CHECK(batch.add() != nullptr);
+    CHECK(WiFiClient::stats().connects == 0);
+    CHECK(batch.rowCount() == rows);
+    CHECK(!row.isNull());
+
+    delay(1100);
+    CHECK(!batch.add());
+    CHECK(WiFiClient::stats().connects == 1);
+    CHECK(batch.rowCount() == 1);
+    CHECK(row.isNull());
+}
+
+// the text NULL is data, only fieldNull() writes SQL null
+void checkCsvNull()
+{
+    StringPrint text, null;
+    PostgrestCsvWriter(text).field("NULL");
+    PostgrestCsvWriter(null).fieldNull();
+    CHECK(text.text == "\"NULL\"");
+    CHECK(null.text == "NULL");
+}
+
+// queued POST of one row; "reject" makes fakeserver refuse it
+const char *queueRow(PostgrestOfflineQueue &queue, const char *name)
+{
+    char row[64];
+    int length = snprintf(row, sizeof(row), "{\"sensor_name\":\"%s\",\"sensor_value\":1}", name);
+    return queue.enqueue("POST", "/sensorvalues", row, (size_t)length);
+}
+
+void countDrops(const char *, size_t records, void *context)
+{
+    *(size_t *)context += records;
+}
+
+// begin() keeps the complete records of a log that ends with a torn or corrupted record
+void checkQueueRecovery(PostgrestClient &client)
+{
+    char buffer[512];
+    remove(QUEUE_LOG);
+    PostgrestPosixQueueStorage storage(QUEUE_LOG);
+    {
+        PostgrestOfflineQueue queue(client, storage, buffer, sizeof(buffer));
+        CHECK(!queue.begin());
+        for (int i = 0; i < 4; i++)
+            CHECK(!queueRow(queue, "temp"));
+        CHECK(queue.pendingRecords() == 4);
+    }
+    uint32_t record = storage.size() / 4;
+
+    // power loss while the last record was written
+    CHECK(truncate(QUEUE_LOG, 4 * record - 5) == 0);
+    {
+        PostgrestOfflineQueue queue(client, storage, buffer, sizeof(buffer));
+        CHECK(!queue.begin());
+        CHECK(queue.pendingRecords() == 3);
+        CHECK(storage.size() == 3 * record);
+    }
+
+    // a flipped payload byte fails the CRC of the last record
+    FILE *f = fopen(QUEUE_LOG, "r+b");
+    CHECK(f && fseek(f, 3 * record - 3, SEEK_SET) == 0 && fputc('X', f) != EOF);
+    if (f)
+        fclose(f);
+    {
+        PostgrestOfflineQueue queue(client, storage, buffer, sizeof(buffer));
+        CHECK(!queue.begin());
+        CHECK(queue.pendingRecords() == 2);
+        CHECK(storage.size() == 2 * record);
+    }
+    remove(QUEUE_LOG);
+}
+
+// a rejected merged POST is replayed one record at a time, and only the rejected record is dropped
+void checkQueueRejectedMerge(PostgrestClient &client)
+{
+    char buffer[512];
+    remove(QUEUE_LOG);
+    PostgrestPosixQueueStorage storage(QUEUE_LOG);
+    PostgrestOfflineQueue queue(client, storage, buffer, sizeof(buffer));
+    size_t drops = 0;
+    queue.onDrop(countDrops, &drops);
+    CHECK(!queue.begin());
+    CHECK(!queueRow(queue, "first"));
+    CHECK(!queueRow(queue, "reject"));
+    CHECK(!queueRow(queue, "third"));
+
+    CHECK(queue.poll() != nullptr); // the merged POST of all three
+    CHECK(queue.pendingRecords() == 3 && drops == 0);
+    CHECK(!queue.poll()); // "first" alone
+    CHECK(queue.pendingRecords() == 2);
+    CHECK(queue.poll() != nullptr); // "reject" alone, dropped
+    CHECK(queue.pendingRecords() == 1 && drops == 1);
+    CHECK(!queue.poll()); // "third" alone
+    CHECK(queue.isEmpty() && drops == 1);
+    CHECK(storage.size() == 0);
+    remove(QUEUE_LOG);
+}
+
+// once the acknowledged part of the log is large enough, compaction leaves only the pending records
+void checkQueueCompaction(PostgrestClient &client)
+{
+    char buffer[512];
+    remove(QUEUE_LOG);
+    PostgrestPosixQueueStorage storage(QUEUE_LOG);
+    PostgrestOfflineQueue queue(client, storage, buffer, sizeof(buffer));
+    CHECK(!queue.begin());
+    queue.setMaxMergedRecords(1);
+    CHECK(!queueRow(queue, "temp"));
+    uint32_t record = storage.size();
+    size_t records = 2 * POSTGREST_QUEUE_COMPACT_THRESHOLD / record + 2;
+    for (size_t i = 1; i < records; i++)
+        CHECK(!queueRow(queue, "temp"));
+
+    bool compacted = false;
+    const char *error = nullptr;
+    while (!compacted && !error && !queue.isEmpty())
+    {
+        uint32_t before = storage.size();
+        error = queue.poll();
+        compacted = storage.size() < before; // otherwise an ack record was appended
+    }
+    CHECK(!error);
+    size_t pending = queue.pendingRecords();
+    CHECK(compacted && pending > 0);
+    // the pending records and the small ack records appended after them are kept
+    CHECK(queue.pendingBytes() == storage.size());
+    CHECK(storage.size() >= pending * record);
+    CHECK(storage.size() - pending * record < (records - pending) * record);
+
+    PostgrestOfflineQueue reopened(client, storage, buffer, sizeof(buffer));
+    CHECK(!reopened.begin());
+    CHECK(reopened.pendingRecords() == pending);
+    while (!reopened.isEmpty() && !reopened.poll())
+        ;
+    CHECK(reopened.isEmpty() && storage.size() == 0);
+    remove(QUEUE_LOG);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': port = (uint16_t)atoi(optarg); break;
+        default: fprintf(stderr, "usage: checks [-p port]\n"); return 2;
+        }
+    }
+
+    WiFiClient::redirect(HOST, port);
+    WiFiClient connection;
+    SelfHostedPostgrestClient client(connection, HOST, "", HOST, "", port);
+    const char *error = client.signIn("sensor@example.com", "benchmark-password");
+    if (error)
+    {
+        fprintf(stderr, "checks: sign in failed: %s (is fakeserver running on port %u?)\n", error, port);
+        return 1;
+    }
+
+    checkBatchFullBufferFailure(client);
+    checkCsvNull();
+    checkQueueRecovery(client);
+    checkQueueRejectedMerge(client);
+    checkQueueCompaction(client);
+
+    printf("%s\n", failures ? "checks failed" : "all checks passed");
+    return failures ? 1 : 0;
+}
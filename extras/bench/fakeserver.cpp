@@ -0,0 +1,637 @@
+/**
+ * Local stand-in for the servers PostgrestClient talks to, for the host benchmarks
+ * (see README.md). One process answers all of them, requests are told apart by path:
+ *
+ *   POST .../sign-in/email            Neon Auth: session cookie in Set-Cookie
+ *   GET  .../get-session              Neon Auth: JWT in set-auth-jwt (needs the cookie)
+ *   POST .../token?grant_type=...     Supabase Auth: password and refresh_token grants
+ *   POST .../rpc/<fn>, Content-Profile: auth
+ *                                     self-hosted login/refresh RPC: {"token": ...}
+ *   GET/HEAD/POST/PATCH/DELETE .../<table>, POST .../rpc/<fn>
+ *                                     data API, needs "Authorization: Bearer"
+ *
+ * Tables are synthetic: every table has the same numbered rows, filters are ignored apart from
+ * limit/offset and Range, inserted rows are counted and discarded. Writes with a row containing the
+ * value "reject" fail with 400, like a constraint violation. The response framing, headers
+ * and status codes follow PostgREST, so the bytes on the wire are realistic.
+ *
+ * usage: fakeserver [-p port] [-r rows] [-d delay] [-c] [-z] [-q]
+ */
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#ifdef FAKESERVER_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+
+struct Options
+{
+    int port = 8431;
+    long rows = 1000;    // rows of every table
+    long delay = 0;      // milliseconds before each response, to emulate a slow link
+    bool chunked = false; // Transfer-Encoding: chunked like a reverse proxy
+    bool gzip = false;   // compress when the request accepts gzip
+    bool quiet = false;
+};
+
+Options options;
+std::atomic<unsigned long> sessionCounter(0);
+
+struct Request
+{
+    std::string method;
+    std::string target; // path and query
+    std::string path;
+    std::string query;
+    std::string headers; // "name: value\r\n" lines, names lower case
+    std::string body;
+    bool close = false;
+};
+
+struct Response
+{
+    int status = 200;
+    std::string headers; // extra "Name: value\r\n" lines
+    std::string body;
+    bool hasBody = true;
+};
+
+const char *reason(int status)
+{
+    switch (status)
+    {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    default: return "Unknown";
+    }
+}
+
+// value of a request header (name in lower case), empty if missing
+std::string header(const Request &req, const char *name)
+{
+    std::string key = std::string("\n") + name + ":";
+    std::string all = "\n" + req.headers;
+    size_t at = all.find(key);
+    if (at == std::string::npos)
+        return std::string();
+    size_t start = all.find_first_not_of(' ', at + key.size());
+    size_t end = all.find('\r', start);
+    return all.substr(start, end - start);
+}
+
+// value of a query parameter, fallback if missing
+long queryNumber(const Request &req, const char *name, long fallback)
+{
+    std::string key = std::string(name) + "=";
+    size_t at = 0;
+    while ((at = req.query.find(key, at)) != std::string::npos)
+    {
+        if (at == 0 || req.query[at - 1] == '&')
+            return strtol(req.query.c_str() + at + key.size(), nullptr, 10);
+        at += key.size();
+    }
+    return fallback;
+}
+
+bool endsWith(const std::string &text, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return text.size() >= n && text.compare(text.size() - n, n, suffix) == 0;
+}
+
+std::string base64(const std::string &data)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < data.size(); i += 3)
+    {
+        uint32_t v = (uint8_t)data[i] << 16 | (uint8_t)data[i + 1] << 8 | (uint8_t)data[i + 2];
+        out += alphabet[v >> 18];
+        out += alphabet[(v >> 12) & 63];
+        out += alphabet[(v >> 6) & 63];
+        out += alphabet[v & 63];
+    }
+    if (i < data.size())
+    {
+        uint32_t v = (uint8_t)data[i] << 16 | (i + 1 < data.size() ? (uint8_t)data[i + 1] << 8 : 0);
+        out += alphabet[v >> 18];
+        out += alphabet[(v >> 12) & 63];
+        if (i + 1 < data.size())
+            out += alphabet[(v >> 6) & 63];
+    }
+    return out; // unpadded, as in JWTs
+}
+
+// unsigned JWT with the claims the client reads (iat, exp) and typical others
+std::string makeJwt(const char *role)
+{
+    long now = (long)time(nullptr);
+    char payload[256];
+    snprintf(payload, sizeof(payload),
+             "{\"sub\":\"8f2c0b7e-5d41-4a3b-9c8e-%012lu\",\"email\":\"sensor@example.com\",\"role\":\"%s\","
+             "\"aud\":\"authenticated\",\"iat\":%ld,\"exp\":%ld}",
+             sessionCounter.load(), role, now, now + 3600);
+    return base64("{\"alg\":\"HS256\",\"typ\":\"JWT\"}") + "." + base64(payload) +
+           ".c2lnbmF0dXJlLW5vdC1jaGVja2VkLWJ5LXRoZS1mYWtlLXNlcnZlcg";
+}
+
+std::string row(long id)
+{
+    char text[160];
+    snprintf(text, sizeof(text),
+             "{\"id\":%ld,\"sensor_name\":\"temperature\",\"sensor_value\":%.1f,\"created_at\":\"2025-01-01T00:%02ld:%02ld+00:00\"}",
+             id, 18.0 + (id % 70) / 10.0, (id / 60) % 60, id % 60);
+    return text;
+}
+
+// rows of a JSON array or CSV body
+long countRows(const Request &req)
+{
+    if (header(req, "content-type").find("text/csv") != std::string::npos)
+    {
+        long lines = 0;
+        for (char c : req.body)
+            lines += c == '\n';
+        return lines > 0 ? lines - 1 : 0; // without the header line
+    }
+    long rows = 0;
+    int depth = 0;
+    int rowDepth = !req.body.empty() && req.body[0] == '[' ? 1 : 0;
+    bool inString = false;
+    for (size_t i = 0; i < req.body.size(); i++)
+    {
+        char c = req.body[i];
+        if (inString)
+        {
+            if (c == '\\')
+                i++;
+            else if (c == '"')
+                inString = false;
+        }
+        else if (c == '"')
+            inString = true;
+        else if (c == '{' || c == '[')
+        {
+            if (c == '{' && depth == rowDepth)
+                rows++;
+            depth++;
+        }
+        else if (c == '}' || c == ']')
+            depth--;
+    }
+    return rows;
+}
+
+Response unauthorized()
+{
+    Response res;
+    res.status = 401;
+    res.headers = "WWW-Authenticate: Bearer\r\n";
+    res.body = "{\"code\":\"PGRST301\",\"details\":null,\"hint\":null,\"message\":\"No suitable key or wrong key type\"}";
+    return res;
+}
+
+Response auth(const Request &req)
+{
+    Response res;
+    std::string user = "\"user\":{\"id\":\"8f2c0b7e-5d41-4a3b-9c8e-0a1b2c3d4e5f\",\"email\":\"sensor@example.com\",\"emailVerified\":true}";
+    if (endsWith(req.path, "/sign-in/email"))
+    {
+        if (req.body.find("\"password\"") == std::string::npos)
+        {
+            res.status = 400;
+            res.body = "{\"message\":\"password is required\"}";
+            return res;
+        }
+        char token[64];
+        snprintf(token, sizeof(token), "s%lu.ZmFrZS1zZXNzaW9uLXRva2Vu", ++sessionCounter);
+        res.headers = "set-cookie: __Secure-neon-auth.state=; Max-Age=0; Path=/; HttpOnly; Secure; SameSite=None\r\n"
+                      "set-cookie: __Secure-neon-auth.session_token=" +
+                      std::string(token) + "; Max-Age=604800; Path=/; HttpOnly; Secure; SameSite=None\r\n";
+        res.body = "{\"redirect\":false,\"token\":\"" + std::string(token) + "\"," + user + "}";
+    }
+    else if (endsWith(req.path, "/get-session"))
+    {
+        if (header(req, "cookie").find("__Secure-neon-auth.session_token=") == std::string::npos)
+            return unauthorized();
+        res.headers = "set-auth-jwt: " + makeJwt("authenticated") + "\r\n";
+        res.body = "{\"session\":{\"expiresAt\":\"2030-01-01T00:00:00.000Z\"}," + user + "}";
+    }
+    else if (req.path.find("/token") != std::string::npos)
+    {
+        bool refresh = req.query.find("grant_type=refresh_token") != std::string::npos;
+        if (refresh ? req.body.find("\"refresh_token\"") == std::string::npos : req.body.find("\"password\"") == std::string::npos)
+        {
+            res.status = 400;
+            res.body = "{\"error\":\"invalid_grant\"}";
+            return res;
+        }
+        char refreshToken[32];
+        snprintf(refreshToken, sizeof(refreshToken), "r%lu", ++sessionCounter);
+        res.body = "{\"access_token\":\"" + makeJwt("authenticated") +
+                   "\",\"token_type\":\"bearer\",\"expires_in\":3600,\"refresh_token\":\"" + refreshToken + "\"," + user + "}";
+    }
+    else
+    {
+        // login and refresh RPCs of the self-hosted setup (schema auth)
+        ++sessionCounter;
+        res.body = "{\"token\":\"" + makeJwt("web_user") + "\"}";
+    }
+    return res;
+}
+
+Response dataApi(const Request &req)
+{
+    Response res;
+    if (header(req, "authorization").compare(0, 7, "Bearer ") != 0)
+        return unauthorized();
+
+    std::string prefer = header(req, "prefer");
+    bool counted = prefer.find("count=") != std::string::npos;
+    bool representation = prefer.find("return=representation") != std::string::npos;
+
+    if (req.path.find("/rpc/") != std::string::npos)
+    {
+        char text[96];
+        snprintf(text, sizeof(text), "{\"avg_value\":21.4,\"min_value\":18.0,\"max_value\":24.9,\"count\":%ld}", options.rows);
+        res.body = text;
+        return res;
+    }
+
+    if (req.method == "GET" || req.method == "HEAD")
+    {
+        long first = queryNumber(req, "offset", 0);
+        long rows = queryNumber(req, "limit", options.rows);
+        std::string range = header(req, "range");
+        if (!range.empty())
+        {
+            char *end;
+            first = strtol(range.c_str(), &end, 10);
+            rows = *end == '-' ? strtol(end + 1, nullptr, 10) - first + 1 : options.rows;
+        }
+        char contentRange[64];
+        if (first >= options.rows && options.rows > 0)
+        {
+            res.status = 416;
+            snprintf(contentRange, sizeof(contentRange), "Content-Range: */%ld\r\n", options.rows);
+            res.headers = contentRange;
+            res.body = "{\"code\":\"PGRST103\",\"details\":null,\"hint\":null,\"message\":\"Requested range not satisfiable\"}";
+            return res;
+        }
+        long last = first + rows > options.rows ? options.rows - 1 : first + rows - 1;
+        if (counted)
+            snprintf(contentRange, sizeof(contentRange), "Content-Range: %ld-%ld/%ld\r\n", first, last, options.rows);
+        else
+            snprintf(contentRange, sizeof(contentRange), "Content-Range: %ld-%ld/*\r\n", first, last);
+        res.headers = contentRange;
+        if (counted && (first > 0 || last < options.rows - 1))
+            res.status = 206;
+        res.body = "[";
+        for (long id = first; id <= last; id++)
+        {
+            if (id > first)
+                res.body += ",";
+            res.body += row(id + 1);
+        }
+        res.body += "]";
+        res.hasBody = req.method == "GET";
+        return res;
+    }
+
+    // a row with the value "reject" violates a check constraint, see checks.cpp
+    if (req.body.find("\"reject\"") != std::string::npos)
+    {
+        res.status = 400;
+        res.body = "{\"code\":\"23514\",\"details\":null,\"hint\":null,\"message\":\"new row violates check constraint\"}";
+        return res;
+    }
+
+    long rows = req.method == "POST" ? countRows(req) : 1;
+    if (req.method == "POST")
+        res.status = 201;
+    else if (req.method == "PATCH" || req.method == "DELETE")
+        res.status = 204;
+    else
+    {
+        res.status = 405;
+        res.body = "{\"message\":\"method not allowed\"}";
+        return res;
+    }
+    char contentRange[48];
+    snprintf(contentRange, sizeof(contentRange), "Content-Range: */%s\r\n", counted ? std::to_string(rows).c_str() : "*");
+    res.headers = contentRange;
+    if (representation)
+    {
+        if (res.status == 204)
+            res.status = 200;
+        res.body = "[";
+        for (long id = 0; id < rows; id++)
+            res.body += (id ? "," : "") + row(id + 1);
+        res.body += "]";
+    }
+    else
+    {
+        res.hasBody = false;
+    }
+    return res;
+}
+
+Response route(const Request &req)
+{
+    bool authPath = req.path.find("/sign-in/") != std::string::npos || endsWith(req.path, "/get-session") ||
+                    endsWith(req.path, "/token") || header(req, "content-profile") == "auth";
+    return authPath ? auth(req) : dataApi(req);
+}
+
+#ifdef FAKESERVER_ZLIB
+bool gzipBody(std::string &body)
+{
+    z_stream z = {};
+    if (deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    std::string out(deflateBound(&z, body.size()), '\0');
+    z.next_in = (Bytef *)body.data();
+    z.avail_in = (uInt)body.size();
+    z.next_out = (Bytef *)&out[0];
+    z.avail_out = (uInt)out.size();
+    int result = deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    if (result != Z_STREAM_END)
+        return false;
+    body.swap(out);
+    return true;
+}
+#endif
+
+// read from the socket into pending until it holds at least 'want' bytes
+bool fill(int fd, std::string &pending, size_t want)
+{
+    char buffer[4096];
+    while (pending.size() < want)
+    {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        pending.append(buffer, (size_t)n);
+    }
+    return true;
+}
+
+bool readLine(int fd, std::string &pending, std::string &line)
+{
+    size_t end;
+    while ((end = pending.find("\r\n")) == std::string::npos)
+    {
+        if (pending.size() > 65536 || !fill(fd, pending, pending.size() + 1))
+            return false;
+    }
+    line = pending.substr(0, end);
+    pending.erase(0, end + 2);
+    return true;
+}
+
+bool readRequest(int fd, std::string &pending, Request &req)
+{
+    std::string line;
+    if (!readLine(fd, pending, line))
+        return false;
+    size_t space1 = line.find(' ');
+    size_t space2 = line.rfind(' ');
+    if (space1 == std::string::npos || space2 == space1)
+        return false;
+    req.method = line.substr(0, space1);
+    req.target = line.substr(space1 + 1, space2 - space1 - 1);
+    size_t question = req.target.find('?');
+    req.path = req.target.substr(0, question);
+    req.query = question == std::string::npos ? std::string() : req.target.substr(question + 1);
+    req.close = line.compare(space2 + 1, std::string::npos, "HTTP/1.0") == 0;
+
+    req.headers.clear();
+    while (readLine(fd, pending, line) && !line.empty())
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            return false;
+        for (size_t i = 0; i < colon; i++)
+            line[i] = (char)tolower((unsigned char)line[i]);
+        req.headers += line + "\r\n";
+    }
+    if (!line.empty())
+        return false;
+
+    std::string connection = header(req, "connection");
+    if (!connection.empty())
+        req.close = strcasestr(connection.c_str(), "close") != nullptr;
+
+    req.body.clear();
+    if (header(req, "transfer-encoding").find("chunked") != std::string::npos)
+    {
+        for (;;)
+        {
+            if (!readLine(fd, pending, line))
+                return false;
+            size_t size = strtoul(line.c_str(), nullptr, 16);
+            if (size == 0)
+            {
+                while (readLine(fd, pending, line) && !line.empty())
+                    ; // trailers
+                return line.empty();
+            }
+            if (!fill(fd, pending, size + 2))
+                return false;
+            req.body.append(pending, 0, size);
+            pending.erase(0, size + 2);
+        }
+    }
+    std::string length = header(req, "content-length");
+    size_t size = length.empty() ? 0 : strtoul(length.c_str(), nullptr, 10);
+    if (!fill(fd, pending, size))
+        return false;
+    req.body.assign(pending, 0, size);
+    pending.erase(0, size);
+    return true;
+}
+
+bool sendAll(int fd, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+bool sendResponse(int fd, const Request &req, Response &res)
+{
+    bool body = res.hasBody && res.status != 204;
+    bool gzip = false;
+#ifdef FAKESERVER_ZLIB
+    if (body && options.gzip && header(req, "accept-encoding").find("gzip") != std::string::npos)
+        gzip = gzipBody(res.body);
+#endif
+    char line[64];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", res.status, reason(res.status));
+    std::string head = line;
+    time_t now = time(nullptr);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    char date[64];
+    strftime(date, sizeof(date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &utc);
+    head += date;
+    head += "Server: postgrest/12.2.3\r\n";
+    head += res.headers;
+    if (body || req.method == "HEAD")
+        head += "Content-Type: application/json; charset=utf-8\r\n";
+    if (gzip)
+        head += "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+    if (req.close)
+        head += "Connection: close\r\n";
+    std::string payload = body ? res.body : std::string();
+    if (options.chunked && body)
+    {
+        head += "Transfer-Encoding: chunked\r\n\r\n";
+        // proxies forward in pieces of their buffer size
+        std::string chunked;
+        for (size_t at = 0; at < payload.size(); at += 4096)
+        {
+            size_t size = payload.size() - at < 4096 ? payload.size() - at : 4096;
+            char sizeLine[16];
+            snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", size);
+            chunked += sizeLine;
+            chunked.append(payload, at, size);
+            chunked += "\r\n";
+        }
+        chunked += "0\r\n\r\n";
+        payload.swap(chunked);
+    }
+    else
+    {
+        if (res.status != 204)
+        {
+            snprintf(line, sizeof(line), "Content-Length: %zu\r\n", req.method == "HEAD" ? res.body.size() : payload.size());
+            head += line;
+        }
+        head += "\r\n";
+    }
+    if (req.method == "HEAD")
+        payload.clear();
+    return sendAll(fd, head + payload);
+}
+
+void serve(int fd)
+{
+    std::string pending;
+    Request req;
+    while (readRequest(fd, pending, req))
+    {
+        Response res = route(req);
+        if (!options.quiet)
+            fprintf(stderr, "%s %s -> %d\n", req.method.c_str(), req.target.c_str(), res.status);
+        if (options.delay > 0)
+        {
+            struct timespec ts = {options.delay / 1000, (options.delay % 1000) * 1000000L};
+            nanosleep(&ts, nullptr);
+        }
+        if (!sendResponse(fd, req, res) || req.close)
+            break;
+    }
+    close(fd);
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: fakeserver [-p port] [-r rows] [-d delay] [-c] [-z] [-q]\n"
+            "  -p port   TCP port on 127.0.0.1 (default 8431)\n"
+            "  -r rows   rows of every table (default 1000)\n"
+            "  -d delay  milliseconds before each response (default 0)\n"
+            "  -c        chunked responses, like a reverse proxy\n"
+            "  -z        gzip responses when accepted (needs a build with zlib)\n"
+            "  -q        don't log requests\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:d:czqh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': options.port = atoi(optarg); break;
+        case 'r': options.rows = atol(optarg); break;
+        case 'd': options.delay = atol(optarg); break;
+        case 'c': options.chunked = true; break;
+        case 'z': options.gzip = true; break;
+        case 'q': options.quiet = true; break;
+        default: usage(); return 2;
+        }
+    }
+#ifndef FAKESERVER_ZLIB
+    if (options.gzip)
+    {
+        fprintf(stderr, "fakeserver: built without zlib, -z is not available\n");
+        return 2;
+    }
+#endif
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)options.port);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        perror("fakeserver");
+        return 1;
+    }
+    fprintf(stderr, "fakeserver: listening on 127.0.0.1:%d\n", options.port);
+    for (;;)
+    {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(serve, fd).detach();
+    }
+}
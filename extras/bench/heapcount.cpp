@@ -0,0 +1,125 @@
+#include "heapcount.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <new>
+
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t count, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+    void __real_free(void *ptr);
+}
+
+namespace
+{
+HeapStats stats;
+
+void counted(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    stats.allocations++;
+    stats.bytes += size;
+    stats.live += malloc_usable_size(ptr);
+    if (stats.live > stats.peak)
+        stats.peak = stats.live;
+}
+
+void released(void *ptr)
+{
+    if (!ptr)
+        return;
+    stats.frees++;
+    stats.live -= malloc_usable_size(ptr);
+}
+} // namespace
+
+HeapStats &heapStats()
+{
+    return stats;
+}
+
+void resetHeapStats()
+{
+    stats.allocations = 0;
+    stats.frees = 0;
+    stats.bytes = 0;
+    stats.peak = stats.live;
+}
+
+extern "C"
+{
+    void *__wrap_malloc(size_t size)
+    {
+        void *ptr = __real_malloc(size);
+        counted(ptr, size);
+        return ptr;
+    }
+
+    void *__wrap_calloc(size_t count, size_t size)
+    {
+        void *ptr = __real_calloc(count, size);
+        counted(ptr, count * size);
+        return ptr;
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        size_t before = ptr ? malloc_usable_size(ptr) : 0;
+        void *moved = __real_realloc(ptr, size);
+        if (!moved)
+            return moved;
+        if (moved != ptr)
+        {
+            // counted as a new allocation, a block grown in place is not
+            stats.allocations++;
+            stats.bytes += size;
+            if (ptr)
+                stats.frees++;
+        }
+        stats.live += malloc_usable_size(moved) - before;
+        if (stats.live > stats.peak)
+            stats.peak = stats.live;
+        return moved;
+    }
+
+    void __wrap_free(void *ptr)
+    {
+        released(ptr);
+        __real_free(ptr);
+    }
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = __wrap_malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    __wrap_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    __wrap_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    __wrap_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    __wrap_free(ptr);
+}
@@ -0,0 +1,23 @@
+#ifndef HEAPCOUNT_H
+#define HEAPCOUNT_H
+#include <stddef.h>
+
+/**
+ * Heap allocations of the benchmark process, counted by wrapping malloc, calloc, realloc and
+ * free (linker option --wrap, see Makefile) and by replacing operator new/delete.
+ */
+struct HeapStats
+{
+    unsigned long allocations; // malloc, calloc, new and realloc that moves or creates a block
+    unsigned long frees;
+    unsigned long long bytes;  // bytes requested by these allocations
+    size_t live;               // bytes currently allocated
+    size_t peak;               // most bytes allocated at the same time since the last reset
+};
+
+HeapStats &heapStats();
+
+// set the counters to zero, peak to the current live bytes
+void resetHeapStats();
+
+#endif // HEAPCOUNT_H
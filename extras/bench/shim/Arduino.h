@@ -0,0 +1,307 @@
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+/**
+ * Minimal Arduino core for building PostgrestClient on Linux (see extras/bench/README.md).
+ * Only what the library and ArduinoJson's Print/Stream support use: Print, Stream, Client,
+ * millis()/delay()/yield(), random() and a Serial on stdout.
+ * ARDUINO is not defined, ArduinoJson's Stream/Print support is enabled by the Makefile.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <string>
+
+#define DEC 10
+#define HEX 16
+
+inline unsigned long micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+inline unsigned long millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+// called by yield(): lets the network shim wait for socket data instead of spinning
+inline void (*arduinoShimYieldHook)() = nullptr;
+
+inline void yield()
+{
+    if (arduinoShimYieldHook)
+        arduinoShimYieldHook();
+    else
+        sched_yield();
+}
+
+inline void delay(unsigned long ms)
+{
+    if (ms == 0)
+    {
+        yield();
+        return;
+    }
+    struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+    nanosleep(&ts, nullptr);
+}
+
+inline long random(long howbig)
+{
+    return howbig > 0 ? ::random() % howbig : 0;
+}
+
+inline long random(long howsmall, long howbig)
+{
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+inline void randomSeed(unsigned long seed)
+{
+    srandom((unsigned int)seed);
+}
+
+// enough String for the overloads of PostgrestQuery and PostgrestCsvWriter
+class String
+{
+public:
+    String(const char *text = "") : _text(text ? text : "") {}
+    const char *c_str() const { return _text.c_str(); }
+    unsigned int length() const { return (unsigned int)_text.length(); }
+    bool concat(const char *text)
+    {
+        _text += text;
+        return true;
+    }
+    String &operator+=(const char *text)
+    {
+        concat(text);
+        return *this;
+    }
+
+private:
+    std::string _text;
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size-- && write(*buffer++))
+            n++;
+        return n;
+    }
+    size_t write(const char *text) { return text ? write((const uint8_t *)text, strlen(text)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t print(const char *text) { return write(text); }
+    size_t print(const String &text) { return write(text.c_str(), text.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC)
+    {
+        if (base == DEC && value < 0)
+            return print('-') + printNumber(0UL - (unsigned long)value, DEC);
+        return printNumber((unsigned long)value, base);
+    }
+    size_t print(unsigned long value, int base = DEC) { return printNumber(value, base); }
+    size_t print(double value, int digits = 2) { return printFloat(value, digits); }
+
+    size_t println() { return write("\r\n", 2); }
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+    template <typename T>
+    size_t println(T value, int format) { return print(value, format) + println(); }
+
+private:
+    size_t printNumber(unsigned long value, int base)
+    {
+        char buffer[8 * sizeof(long) + 1];
+        char *p = &buffer[sizeof(buffer)];
+        if (base < 2)
+            base = 10;
+        do
+        {
+            unsigned long digit = value % base;
+            value /= base;
+            *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+        } while (value);
+        return write(p, &buffer[sizeof(buffer)] - p);
+    }
+
+    // same output as the Arduino cores
+    size_t printFloat(double value, int digits)
+    {
+        if (isnan(value))
+            return print("nan");
+        if (isinf(value))
+            return print("inf");
+        if (value > 4294967040.0 || value < -4294967040.0)
+            return print("ovf");
+        size_t n = 0;
+        if (value < 0.0)
+        {
+            n += print('-');
+            value = -value;
+        }
+        double rounding = 0.5;
+        for (int i = 0; i < digits; i++)
+            rounding /= 10.0;
+        value += rounding;
+        unsigned long whole = (unsigned long)value;
+        double remainder = value - (double)whole;
+        n += print(whole);
+        if (digits > 0)
+            n += print('.');
+        while (digits-- > 0)
+        {
+            remainder *= 10.0;
+            unsigned int digit = (unsigned int)remainder;
+            n += print(digit);
+            remainder -= digit;
+        }
+        return n;
+    }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+
+    bool find(const char *target) { return findUntil(target, nullptr); }
+
+    bool findUntil(const char *target, const char *terminator)
+    {
+        size_t targetLength = strlen(target);
+        size_t terminatorLength = terminator ? strlen(terminator) : 0;
+        size_t matched = 0, terminatorMatched = 0;
+        if (targetLength == 0)
+            return true;
+        int c;
+        while ((c = timedRead()) >= 0)
+        {
+            // restart like the Arduino core does: good enough for header names
+            matched = c == target[matched] ? matched + 1 : (c == target[0] ? 1 : 0);
+            if (matched == targetLength)
+                return true;
+            if (terminatorLength)
+            {
+                terminatorMatched = c == terminator[terminatorMatched] ? terminatorMatched + 1 : (c == terminator[0] ? 1 : 0);
+                if (terminatorMatched == terminatorLength)
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0)
+                break;
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+    size_t readBytesUntil(char terminator, char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0 || c == terminator)
+                break;
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+
+protected:
+    int timedRead()
+    {
+        unsigned long start = millis();
+        do
+        {
+            int c = read();
+            if (c >= 0)
+                return c;
+            yield();
+        } while (millis() - start < _timeout);
+        return -1;
+    }
+
+    unsigned long _timeout = 1000;
+};
+
+class IPAddress
+{
+public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address((uint32_t)a << 24 | (uint32_t)b << 16 | (uint32_t)c << 8 | d) {}
+    uint8_t operator[](int index) const { return (uint8_t)(_address >> (24 - 8 * index)); }
+    bool operator==(const IPAddress &other) const { return _address == other._address; }
+
+private:
+    uint32_t _address; // host byte order
+};
+
+class Client : public Stream
+{
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char *host, uint16_t port) = 0;
+    using Print::write;
+    virtual int read(uint8_t *buffer, size_t size) = 0;
+    using Stream::read;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+// Serial.print() goes to stdout
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override { fflush(stdout); }
+    operator bool() { return true; }
+};
+
+inline HardwareSerial Serial;
+
+#endif // ARDUINO_SHIM_H
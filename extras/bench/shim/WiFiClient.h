@@ -0,0 +1,289 @@
+#ifndef WIFICLIENT_SHIM_H
+#define WIFICLIENT_SHIM_H
+/**
+ * WiFiClient over POSIX TCP sockets for host builds (see extras/bench/README.md).
+ * Behaves like the Arduino WiFi libraries: connect() blocks, read()/available() never block and
+ * every write() is sent at once (TCP_NODELAY), so the number of writes and the bytes on the wire
+ * match what a board would send. TLS is not emulated: WiFiSSLClient is the same plain client.
+ * WiFiClient::redirect() sends all connections to a local test server regardless of host and port.
+ */
+#include "Arduino.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/**
+ * Traffic of all WiFiClients since the last reset(), see WiFiClient::stats()
+ */
+struct WiFiClientStats
+{
+    unsigned long connects;
+    unsigned long writes; // write() calls, each one a TCP segment (or TLS record) on a board
+    unsigned long long bytesSent;
+    unsigned long long bytesReceived;
+
+    void reset()
+    {
+        connects = 0;
+        writes = 0;
+        bytesSent = 0;
+        bytesReceived = 0;
+    }
+};
+
+class WiFiClient : public Client
+{
+public:
+    WiFiClient() : _fd(-1), _eof(false), _pos(0), _len(0)
+    {
+        arduinoShimYieldHook = &WiFiClient::waitForData;
+    }
+
+    virtual ~WiFiClient()
+    {
+        stop();
+    }
+
+    WiFiClient(const WiFiClient &) = delete;
+    WiFiClient &operator=(const WiFiClient &) = delete;
+
+    // connect to host:port instead of the requested host and port, nullptr to connect as requested
+    static void redirect(const char *host, uint16_t port)
+    {
+        redirectHost() = host;
+        redirectPort() = port;
+    }
+
+    static WiFiClientStats &stats()
+    {
+        static WiFiClientStats stats = {};
+        return stats;
+    }
+
+    int connect(IPAddress ip, uint16_t port) override
+    {
+        char host[16];
+        snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        return connect(host, port);
+    }
+
+    int connect(const char *host, uint16_t port) override
+    {
+        stop();
+        if (redirectHost())
+        {
+            host = redirectHost();
+            port = redirectPort();
+        }
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *addresses = nullptr;
+        if (getaddrinfo(host, service, &hints, &addresses) != 0)
+            return 0;
+        for (struct addrinfo *a = addresses; a && _fd < 0; a = a->ai_next)
+        {
+            _fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (_fd < 0)
+                continue;
+            if (::connect(_fd, a->ai_addr, a->ai_addrlen) != 0)
+            {
+                close(_fd);
+                _fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (_fd < 0)
+            return 0;
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        _eof = false;
+        _pos = _len = 0;
+        link();
+        stats().connects++;
+        return 1;
+    }
+
+    using Print::write;
+
+    size_t write(uint8_t c) override
+    {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (_fd < 0 || size == 0)
+            return 0;
+        stats().writes++;
+        size_t sent = 0;
+        while (sent < size)
+        {
+            ssize_t n = send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                stop();
+                break;
+            }
+            sent += (size_t)n;
+        }
+        stats().bytesSent += sent;
+        return sent;
+    }
+
+    int available() override
+    {
+        if (_pos == _len)
+            fill();
+        return (int)(_len - _pos);
+    }
+
+    int read() override
+    {
+        if (!available())
+            return -1;
+        return _buffer[_pos++];
+    }
+
+    int read(uint8_t *buffer, size_t size) override
+    {
+        size_t n = (size_t)available();
+        if (n == 0)
+            return -1;
+        if (n > size)
+            n = size;
+        memcpy(buffer, _buffer + _pos, n);
+        _pos += n;
+        return (int)n;
+    }
+
+    int peek() override
+    {
+        if (!available())
+            return -1;
+        return _buffer[_pos];
+    }
+
+    void flush() override {}
+
+    void stop() override
+    {
+        if (_fd < 0)
+            return;
+        unlink();
+        close(_fd);
+        _fd = -1;
+        _pos = _len = 0;
+    }
+
+    // like the Arduino libraries: still connected while received data is unread
+    uint8_t connected() override
+    {
+        if (_fd < 0)
+            return 0;
+        available();
+        return !_eof || _pos < _len;
+    }
+
+    operator bool() override
+    {
+        return _fd >= 0;
+    }
+
+private:
+    // read what has arrived without blocking
+    void fill()
+    {
+        _pos = _len = 0;
+        if (_fd < 0 || _eof)
+            return;
+        ssize_t n = recv(_fd, _buffer, sizeof(_buffer), MSG_DONTWAIT);
+        if (n > 0)
+        {
+            _len = (size_t)n;
+            stats().bytesReceived += (unsigned long long)n;
+        }
+        else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            _eof = true;
+        }
+    }
+
+    /**
+     * yield() hook: wait up to a millisecond for data on any open client. The library polls
+     * available() in a loop with delay(0); on a board the WiFi stack runs meanwhile, here the
+     * test server needs the CPU.
+     */
+    static void waitForData()
+    {
+        struct pollfd fds[8];
+        nfds_t count = 0;
+        for (WiFiClient *c = open(); c && count < 8; c = c->_next)
+        {
+            if (c->_pos < c->_len || c->_eof)
+                return;
+            fds[count].fd = c->_fd;
+            fds[count].events = POLLIN;
+            count++;
+        }
+        if (count)
+            poll(fds, count, 1);
+        else
+            sched_yield();
+    }
+
+    static WiFiClient *&open()
+    {
+        static WiFiClient *first = nullptr;
+        return first;
+    }
+
+    static const char *&redirectHost()
+    {
+        static const char *host = nullptr;
+        return host;
+    }
+
+    static uint16_t &redirectPort()
+    {
+        static uint16_t port = 0;
+        return port;
+    }
+
+    void link()
+    {
+        _next = open();
+        open() = this;
+    }
+
+    void unlink()
+    {
+        for (WiFiClient **c = &open(); *c; c = &(*c)->_next)
+        {
+            if (*c == this)
+            {
+                *c = _next;
+                break;
+            }
+        }
+    }
+
+    int _fd;
+    bool _eof;
+    size_t _pos;
+    size_t _len;
+    WiFiClient *_next = nullptr;
+    uint8_t _buffer[1460];
+};
+
+typedef WiFiClient WiFiSSLClient;
+
+#endif // WIFICLIENT_SHIM_H
@@ -0,0 +1,177 @@
+#ifndef POSTGRESTARENA_H
+#define POSTGRESTARENA_H
+#include <ArduinoJson.h>
+
+/**
+ * @brief ArduinoJson allocator that serves the request and response documents from one fixed
+ * memory block instead of the global heap, so filling and clearing them all day long cannot
+ * fragment the heap.
+ * Blocks are taken from the arena like from a stack. A freed block at the top is returned
+ * immediately and the whole arena is reset when the last block is freed, which happens every
+ * time the documents using it are cleared.
+ * If an allocation does not fit, it fails cleanly: deserializeJson() reports NoMemory and
+ * JsonDocument::overflowed() becomes true; the PostgrestClient then returns an error.
+ *
+ * Usage:
+ *   static uint8_t arenaMemory[8192];
+ *   PostgrestArena arena(arenaMemory, sizeof(arenaMemory));
+ *   pgClient.useArena(arena);  // request and response share the arena
+ */
+class PostgrestArena : public ArduinoJson::Allocator
+{
+public:
+    /**
+     * @param buffer memory for the arena, aligned to 8 bytes
+     * @param size size of buffer in bytes
+     */
+    PostgrestArena(void *buffer, size_t size)
+        : _base((uint8_t *)buffer), _capacity(size & ~(size_t)(ALIGN - 1)), _used(0), _top(NONE), _live(0), _highWaterMark(0), _failures(0) {}
+
+    virtual ~PostgrestArena() {}
+
+    void *allocate(size_t size) override
+    {
+        size_t need = HEADER + align(size);
+        if (need < size || _capacity - _used < need)
+        {
+            _failures++;
+            return nullptr;
+        }
+        Header *block = (Header *)(_base + _used);
+        block->size = (uint32_t)align(size);
+        block->previous = _top;
+        _top = (uint32_t)_used;
+        _used += need;
+        _live++;
+        if (_used > _highWaterMark)
+            _highWaterMark = _used;
+        return block + 1;
+    }
+
+    void deallocate(void *ptr) override
+    {
+        if (!ptr)
+            return;
+        Header *block = (Header *)ptr - 1;
+        block->previous |= FREE;
+        _live--;
+        if (_live == 0)
+        {
+            _used = 0;
+            _top = NONE;
+            return;
+        }
+        // pop freed blocks from the top
+        while (_top != NONE && (header(_top)->previous & FREE))
+        {
+            _used = _top;
+            _top = header(_top)->previous & ~FREE;
+        }
+    }
+
+    void *reallocate(void *ptr, size_t new_size) override
+    {
+        if (!ptr)
+            return allocate(new_size);
+        Header *block = (Header *)ptr - 1;
+        size_t offset = (uint8_t *)block - _base;
+        size_t size = align(new_size);
+        if (offset == _top)
+        {
+            // the top block grows or shrinks in place
+            if (size < new_size || _capacity - offset - HEADER < size)
+            {
+                _failures++;
+                return nullptr;
+            }
+            block->size = (uint32_t)size;
+            _used = offset + HEADER + size;
+            if (_used > _highWaterMark)
+                _highWaterMark = _used;
+            return ptr;
+        }
+        if (size <= block->size)
+            return ptr; // shrinking a block below the top: keep it
+        void *moved = allocate(new_size);
+        if (!moved)
+            return nullptr;
+        memcpy(moved, ptr, block->size);
+        deallocate(ptr);
+        return moved;
+    }
+
+    // bytes currently taken from the arena
+    size_t used() const
+    {
+        return _used;
+    }
+
+    size_t capacity() const
+    {
+        return _capacity;
+    }
+
+    // most bytes ever taken at the same time, to size the arena
+    size_t highWaterMark() const
+    {
+        return _highWaterMark;
+    }
+
+    // number of allocations that did not fit
+    size_t failures() const
+    {
+        return _failures;
+    }
+
+    void resetStats()
+    {
+        _highWaterMark = _used;
+        _failures = 0;
+    }
+
+private:
+    struct Header
+    {
+        uint32_t size;     // usable bytes
+        uint32_t previous; // offset of the block below, FREE flag when freed
+    };
+
+    static const size_t ALIGN = 8;
+    static const size_t HEADER = sizeof(Header) > ALIGN ? sizeof(Header) : ALIGN;
+    static const uint32_t FREE = 0x80000000UL;
+    static const uint32_t NONE = 0x7fffffffUL;
+
+    static size_t align(size_t size)
+    {
+        return (size + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    Header *header(uint32_t offset) const
+    {
+        return (Header *)(_base + offset);
+    }
+
+    uint8_t *_base;
+    size_t _capacity;
+    size_t _used;
+    uint32_t _top; // offset of the topmost block, NONE if empty
+    size_t _live;  // allocated blocks not yet freed
+    size_t _highWaterMark;
+    size_t _failures;
+};
+
+/**
+ * @brief PostgrestArena with its memory included, e.g. as a global:
+ *   PostgrestStaticArena<8192> arena;
+ */
+template <size_t Size>
+class PostgrestStaticArena : public PostgrestArena
+{
+public:
+    PostgrestStaticArena() : PostgrestArena(_memory, Size) {}
+
+private:
+    alignas(8) uint8_t _memory[Size];
+};
+
+#endif // POSTGRESTARENA_H
@@ -0,0 +1,525 @@
+#ifndef POSTGRESTASYNCREQUEST_H
+#define POSTGRESTASYNCREQUEST_H
+#include "PostgrestClient.h"
+
+/**
+ * @brief A data API request that runs in the background while the main loop keeps going.
+ * The request is started with beginGet()/beginPost()/beginPatch()/beginDelete()/beginSend() and
+ * driven by poll(), which only handles the bytes that are available and never waits for the
+ * server. Internally it is a state machine over connect -> send -> await status -> headers -> body.
+ *
+ * Every PostgrestAsyncRequest has its own connection and buffer, so several requests can be in
+ * flight at once (one WiFiClient/WiFiSSLClient each). The PostgrestClient provides the host,
+ * the token and the headers; it must be signed in.
+ * The buffer holds the complete request (headers and JSON payload) and then the response body,
+ * so it must be large enough for both, e.g. 2048 bytes.
+ *
+ * Note: opening the connection (TCP connect and TLS handshake) is done by the WiFiClient, which
+ * blocks on most platforms. All other steps are non-blocking.
+ *
+ * Async GETs don't use the client's response cache (see PostgrestClient::setResponseCache());
+ * async writes drop the cached results of their table when they are started.
+ *
+ * Usage:
+ *   WiFiSSLClient uploadConnection;
+ *   char uploadBuffer[2048];
+ *   PostgrestAsyncRequest upload(pgClient, uploadConnection, uploadBuffer, sizeof(uploadBuffer));
+ *   ...
+ *   pgClient.getJsonRequest()["sensor_value"] = value;
+ *   upload.beginPost("/sensorvalues");  // payload is taken from getJsonRequest()
+ *   ...
+ *   // in loop()
+ *   switch (upload.poll())
+ *   {
+ *   case PostgrestAsyncRequest::ASYNC_DONE: ... upload.getBody() ...
+ *   case PostgrestAsyncRequest::ASYNC_ERROR: Serial.println(upload.getError());
+ *   default: break;
+ *   }
+ */
+class PostgrestAsyncRequest
+{
+public:
+    enum Status
+    {
+        ASYNC_IDLE,    // no request started
+        ASYNC_PENDING, // request in progress, call poll() again
+        ASYNC_DONE,    // 2xx response received, see getStatusCode() and getBody()
+        ASYNC_ERROR    // request failed, see getError()
+    };
+
+    /**
+     * @param client signed in PostgrestClient (host, token and headers)
+     * @param connection connection used only by this request
+     * @param buffer holds the request and then the response body
+     * @param bufferSize size of buffer in bytes
+     */
+    PostgrestAsyncRequest(PostgrestClient &client, WiFiClient &connection, char *buffer, size_t bufferSize)
+        : _client(client), _connection(connection), _buffer(buffer), _bufferSize(bufferSize), _state(STATE_IDLE),
+          _error(nullptr), _statusCode(0), _length(0), _sent(0), _start(0), _timeout(20000),
+          _contentLength(-1), _chunked(false), _remaining(0), _chunkState(CHUNK_SIZE), _lineLength(0)
+    {
+        _status[0] = '\0';
+    }
+
+    ~PostgrestAsyncRequest()
+    {
+        abort();
+    }
+
+    // query the given route, like PostgrestClient::doGet()
+    const char *beginGet(const char *route, unsigned long timeout = 20000)
+    {
+        return begin("GET", route, nullptr, 0, timeout);
+    }
+
+    // insert tuples with payload from getJsonRequest(), like PostgrestClient::doPost()
+    const char *beginPost(const char *route, unsigned long timeout = 20000)
+    {
+        return begin("POST", route, nullptr, 0, timeout);
+    }
+
+    // update tuples with payload from getJsonRequest(), like PostgrestClient::doPatch()
+    const char *beginPatch(const char *route, unsigned long timeout = 20000)
+    {
+        return begin("PATCH", route, nullptr, 0, timeout);
+    }
+
+    // delete tuples, like PostgrestClient::doDelete()
+    const char *beginDelete(const char *route, unsigned long timeout = 20000)
+    {
+        return begin("DELETE", route, nullptr, 0, timeout);
+    }
+
+    /**
+     * @brief start a request with an already serialized JSON payload, like PostgrestClient::doSendJson()
+     *
+     * @param verb "POST", "PATCH" or "DELETE"
+     * @param route
+     * @param json serialized JSON payload (need not be null terminated)
+     * @param length number of bytes in json
+     * @param timeout milliseconds for the whole request
+     * @return const char* nullptr if the request was started, error message otherwise
+     */
+    const char *beginSend(const char *verb, const char *route, const char *json, size_t length, unsigned long timeout = 20000)
+    {
+        return begin(verb, route, json, length, timeout);
+    }
+
+    /**
+     * @brief Advance the request as far as possible without waiting. Call regularly from loop().
+     *
+     * @return Status ASYNC_PENDING while the request is in progress, then ASYNC_DONE or ASYNC_ERROR
+     * (ASYNC_IDLE if no request was started)
+     */
+    Status poll()
+    {
+        if (_state != STATE_IDLE && _state != STATE_DONE && _state != STATE_FAILED && millis() - _start >= _timeout)
+            fail(_state == STATE_STATUS ? "request timed out" : "response timed out");
+
+        // run the states until one has to wait for the network
+        while (true)
+        {
+            State previous = _state;
+            switch (_state)
+            {
+            case STATE_CONNECT:
+                pollConnect();
+                break;
+            case STATE_SEND:
+                pollSend();
+                break;
+            case STATE_STATUS:
+                pollStatus();
+                break;
+            case STATE_HEADERS:
+                pollHeaders();
+                break;
+            case STATE_BODY:
+                pollBody();
+                break;
+            default:
+                break;
+            }
+            if (_state == previous)
+                break;
+        }
+
+        switch (_state)
+        {
+        case STATE_IDLE:
+            return ASYNC_IDLE;
+        case STATE_DONE:
+            return ASYNC_DONE;
+        case STATE_FAILED:
+            return ASYNC_ERROR;
+        default:
+            return ASYNC_PENDING;
+        }
+    }
+
+    // stop a request in progress and close its connection
+    void abort()
+    {
+        if (_state != STATE_IDLE && _state != STATE_DONE && _state != STATE_FAILED)
+            _connection.stop();
+        _state = STATE_IDLE;
+    }
+
+    // true while a request is in progress
+    bool isBusy() const
+    {
+        return _state != STATE_IDLE && _state != STATE_DONE && _state != STATE_FAILED;
+    }
+
+    /**
+     * @brief error message of a failed request (the status line for non-2xx responses),
+     * nullptr otherwise
+     */
+    const char *getError() const
+    {
+        return _error;
+    }
+
+    // HTTP status code of the response, 0 if none was received
+    int getStatusCode() const
+    {
+        return _statusCode;
+    }
+
+    /**
+     * @brief the response body (null terminated) after poll() returned ASYNC_DONE.
+     * Parse it with deserializeJson(doc, request.getBody(), request.getBodyLength()).
+     */
+    const char *getBody() const
+    {
+        return _state == STATE_DONE ? _buffer : "";
+    }
+
+    size_t getBodyLength() const
+    {
+        return _state == STATE_DONE ? _length : 0;
+    }
+
+private:
+    enum State
+    {
+        STATE_IDLE,
+        STATE_CONNECT,
+        STATE_SEND,
+        STATE_STATUS,
+        STATE_HEADERS,
+        STATE_BODY,
+        STATE_DONE,
+        STATE_FAILED
+    };
+
+    enum ChunkState
+    {
+        CHUNK_SIZE,    // chunk size line
+        CHUNK_DATA,    // _remaining bytes of chunk data
+        CHUNK_END,     // CRLF after chunk data
+        CHUNK_TRAILERS // trailers after the last chunk, up to an empty line
+    };
+
+    /**
+     * @brief Format the complete request into the buffer and start the state machine.
+     * The token is refreshed here if it is about to expire, before any bytes are sent.
+     */
+    const char *begin(const char *verb, const char *route, const char *json, size_t jsonLength, unsigned long timeout)
+    {
+        if (isBusy())
+            return "request already in progress";
+        _state = STATE_IDLE;
+        if (!_client._isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = _client.refreshTokenIfNeeded();
+        if (error)
+            return error;
+        if (!_client._headerBlock)
+            _client.buildHeaderBlock();
+
+        JsonDocument &payload = _client.getJsonRequest();
+        bool hasBody = strncmp(verb, "GET", 3) != 0;
+        size_t bodyLength = !hasBody ? 0 : json ? jsonLength : measureJson(payload);
+
+        PostgrestCharPrint out(_buffer, _bufferSize);
+        out.print(verb);
+        out.print(" ");
+        out.print(_client._apiPath);
+        out.print(route);
+        out.println(" HTTP/1.1");
+        if (_client._headerBlock)
+            out.write((const uint8_t *)_client._headerBlock, _client._headerBlockLength);
+        else
+            _client.printStaticHeaders(out);
+        out.println("Connection: close");
+        if (hasBody)
+        {
+            out.println("Content-Type: application/json");
+            out.print("Content-Length: ");
+            out.print(bodyLength);
+            out.print("\r\n");
+        }
+        out.print("\r\n");
+
+        _length = out.length();
+        if (_length + bodyLength >= _bufferSize)
+        {
+            payload.clear();
+            return "request too large for buffer";
+        }
+        if (json)
+            memcpy(_buffer + _length, json, bodyLength);
+        else if (hasBody && serializeJson(payload, _buffer + _length, _bufferSize - _length) != bodyLength)
+        {
+            payload.clear();
+            return "payload serialization error";
+        }
+        payload.clear();
+        _length += bodyLength;
+        if (hasBody && _client._cache)
+            _client._cache->invalidate(route); // like the blocking writes of the client
+
+        _error = nullptr;
+        _statusCode = 0;
+        _status[0] = '\0';
+        _sent = 0;
+        _start = millis();
+        _timeout = timeout;
+        _contentLength = -1;
+        _chunked = false;
+        _lineLength = 0;
+        _state = STATE_CONNECT;
+        return nullptr;
+    }
+
+    void fail(const char *error)
+    {
+        _connection.stop();
+        _error = error;
+        _state = STATE_FAILED;
+    }
+
+    void pollConnect()
+    {
+        PostgrestDnsCache *dns = _client._dns; // shared with the blocking requests
+        bool connected = dns ? dns->connect(_connection, _client._apiHost, _client._port) : _connection.connect(_client._apiHost, _client._port);
+        if (!connected)
+        {
+            fail("cannot connect to data api host over Wifi");
+            return;
+        }
+        _state = STATE_SEND;
+    }
+
+    void pollSend()
+    {
+        size_t written = _connection.write((const uint8_t *)_buffer + _sent, _length - _sent);
+        if (written == 0 && !_connection.connected())
+        {
+            fail("connection lost while sending request");
+            return;
+        }
+        _sent += written;
+        if (_sent < _length)
+            return;
+        _connection.flush();
+        _length = 0; // the buffer now collects the response body
+        _buffer[0] = '\0';
+        _state = STATE_STATUS;
+    }
+
+    /**
+     * @brief Collect the next line of the response head in _line (truncated to its size)
+     *
+     * @return true a complete line is in _line, without line end
+     * @return false the rest of the line has not arrived yet
+     */
+    bool readLine()
+    {
+        while (_connection.available() > 0)
+        {
+            int c = _connection.read();
+            if (c < 0)
+                break;
+            if (c == '\n')
+            {
+                if (_lineLength > 0 && _line[_lineLength - 1] == '\r')
+                    _lineLength--;
+                _line[_lineLength] = '\0';
+                _lineLength = 0;
+                return true;
+            }
+            if (_lineLength + 1 < sizeof(_line))
+                _line[_lineLength++] = (char)c;
+        }
+        return false;
+    }
+
+    // fail if the server closed the connection before the response was complete
+    bool checkClosed()
+    {
+        if (_connection.available() > 0 || _connection.connected())
+            return false;
+        fail("connection closed before response was complete");
+        return true;
+    }
+
+    void pollStatus()
+    {
+        if (!readLine())
+        {
+            checkClosed();
+            return;
+        }
+        strncpy(_status, _line, sizeof(_status) - 1);
+        _status[sizeof(_status) - 1] = '\0';
+        int status_code = 0;
+        if (strlen(_status) >= 12)
+            sscanf(_status + 9, "%3d", &status_code);
+        if (status_code == 0)
+        {
+            fail(_status);
+            return;
+        }
+        if (status_code < 200 || status_code >= 300)
+        {
+            _statusCode = status_code;
+            _client.checkTokenRejected(status_code);
+            fail(_status);
+            return;
+        }
+        _statusCode = status_code;
+        _state = STATE_HEADERS;
+    }
+
+    void pollHeaders()
+    {
+        while (readLine())
+        {
+            if (_line[0] == '\0')
+            {
+                // end of headers
+                if (_statusCode == 204 || _statusCode == 304)
+                {
+                    _contentLength = 0;
+                    _chunked = false;
+                }
+                _remaining = _contentLength > 0 ? (size_t)_contentLength : 0;
+                _chunkState = CHUNK_SIZE;
+                _state = STATE_BODY;
+                return;
+            }
+            if (strncasecmp(_line, "content-length:", 15) == 0)
+                _contentLength = strtol(_line + 15, nullptr, 10);
+            else if (strncasecmp(_line, "transfer-encoding:", 18) == 0)
+                _chunked = strstr(_line + 18, "chunked") != nullptr;
+        }
+        checkClosed();
+    }
+
+    // append available body bytes to the buffer, at most max
+    bool readBody(size_t max)
+    {
+        int avail = _connection.available();
+        if (avail <= 0)
+            return false;
+        if ((size_t)avail < max)
+            max = (size_t)avail;
+        if (_length + max >= _bufferSize)
+        {
+            fail("response too large for buffer");
+            return false;
+        }
+        int got = _connection.read((uint8_t *)_buffer + _length, max);
+        if (got <= 0)
+            return false;
+        _length += (size_t)got;
+        _buffer[_length] = '\0';
+        if (_remaining >= (size_t)got)
+            _remaining -= (size_t)got;
+        return true;
+    }
+
+    void finish()
+    {
+        _connection.stop();
+        _state = STATE_DONE;
+    }
+
+    void pollBody()
+    {
+        if (!_chunked && _contentLength >= 0)
+        {
+            while (_remaining > 0 && readBody(_remaining))
+                ;
+            if (_state != STATE_BODY)
+                return;
+            if (_remaining == 0)
+                finish();
+            else
+                checkClosed();
+            return;
+        }
+        if (!_chunked)
+        {
+            // body ends when the server closes the connection
+            while (readBody(_bufferSize))
+                ;
+            if (_state == STATE_BODY && _connection.available() <= 0 && !_connection.connected())
+                finish();
+            return;
+        }
+
+        while (_state == STATE_BODY)
+        {
+            if (_chunkState == CHUNK_DATA)
+            {
+                if (_remaining > 0 && !readBody(_remaining))
+                    break;
+                if (_remaining == 0)
+                    _chunkState = CHUNK_END;
+                continue;
+            }
+            if (!readLine())
+                break;
+            if (_chunkState == CHUNK_END)
+                _chunkState = CHUNK_SIZE;
+            else if (_chunkState == CHUNK_SIZE)
+            {
+                if (!isxdigit((unsigned char)_line[0]))
+                {
+                    fail("Invalid response");
+                    return;
+                }
+                _remaining = strtoul(_line, nullptr, 16);
+                _chunkState = _remaining > 0 ? CHUNK_DATA : CHUNK_TRAILERS;
+            }
+            else if (_line[0] == '\0')
+                finish(); // empty line after the trailers
+        }
+        if (_state == STATE_BODY)
+            checkClosed();
+    }
+
+    PostgrestClient &_client;
+    WiFiClient &_connection;
+    char *_buffer;
+    size_t _bufferSize;
+    State _state;
+    const char *_error;
+    int _statusCode;
+    char _status[64];
+    size_t _length;         // request bytes in _buffer, then response body bytes
+    size_t _sent;           // request bytes written
+    unsigned long _start;   // millis() when the request was started
+    unsigned long _timeout; // milliseconds for the whole request
+    long _contentLength;    // -1 if not sent
+    bool _chunked;
+    size_t _remaining; // body bytes (Content-Length) or bytes of the current chunk not yet read
+    ChunkState _chunkState;
+    char _line[64]; // current line of the response head or chunk framing
+    size_t _lineLength;
+};
+
+#endif // POSTGRESTASYNCREQUEST_H
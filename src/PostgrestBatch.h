@@ -0,0 +1,374 @@
+#ifndef POSTGRESTBATCH_H
+#define POSTGRESTBATCH_H
+#include "PostgrestClient.h"
+#include "PostgrestOfflineQueue.h"
+
+/**
+ * @brief Callback reporting the outcome of a batch insert.
+ *
+ * @param error nullptr if the rows were inserted, error message otherwise
+ * @param rows number of rows the result applies to
+ * @param context pointer passed to PostgrestBatch::onResult()
+ */
+typedef void (*PostgrestBatchCallback)(const char *error, size_t rows, void *context);
+
+/**
+ * @brief Collects rows for one table and inserts them with a single POST of a JSON array
+ * (Postgrest bulk insert, see https://docs.postgrest.org/en/stable/references/api/tables_views.html#bulk-insert).
+ * Rows are kept in serialized form in a fixed buffer of BufferSize bytes, so no JsonDocument
+ * is needed for the whole batch.
+ * The batch is sent when maxRows rows or maxBytes bytes are buffered, when the oldest row is
+ * older than maxAge milliseconds (checked by poll()) or when flush() is called.
+ *
+ * Failures:
+ * - connection failures, timeouts and server errors (5xx, 408, 429, 401) keep all rows buffered;
+ *   the batch is sent again with the next automatic flush after a growing retry delay.
+ * - other client errors (4xx) mean that at least one row is rejected by the database.
+ *   The rows are then sent one by one: accepted rows are removed, rejected rows are dropped and
+ *   reported, so a single bad row cannot block the buffer.
+ * With setOfflineQueue() batches that fail with a transient error are moved to a
+ * PostgrestOfflineQueue instead of staying in the buffer.
+ *
+ * Usage:
+ *   PostgrestBatch<2048> batch(pgClient, "/sensorvalues", 50, 60000);
+ *   JsonDocument &row = pgClient.getJsonRequest();
+ *   row["sensor_name"] = "temperature";
+ *   row["sensor_value"] = 21.5;
+ *   batch.add();   // takes the row from getJsonRequest()
+ *   batch.poll();  // call from loop() to flush by age
+ */
+template <size_t BufferSize = 2048>
+class PostgrestBatch
+{
+public:
+    /**
+     * @param client signed in PostgrestClient used to send the batches
+     * @param route table route like "/sensorvalues"
+     * @param maxRows flush when this many rows are buffered
+     * @param maxAge flush (in poll()) when the oldest buffered row is older than this (milliseconds)
+     */
+    PostgrestBatch(PostgrestClient &client, const char *route, size_t maxRows = 50, unsigned long maxAge = 60000)
+        : _client(client), _route(route), _maxRows(maxRows), _maxBytes(BufferSize), _maxAge(maxAge), _timeout(20000),
+          _rows(0), _used(1), _firstRowTime(0), _retryAt(0), _retryDelay(0), _callback(nullptr), _context(nullptr), _lastError(nullptr), _queue(nullptr), _queueVerb("POST")
+    {
+        _buffer[0] = '[';
+    }
+
+    /**
+     * @brief Change the flush thresholds
+     *
+     * @param maxRows flush when this many rows are buffered
+     * @param maxBytes flush when the serialized batch reaches this many bytes (at most BufferSize)
+     * @param maxAge flush when the oldest row is older than this (milliseconds), 0 to disable
+     */
+    void setFlushThresholds(size_t maxRows, size_t maxBytes, unsigned long maxAge)
+    {
+        _maxRows = maxRows;
+        _maxBytes = maxBytes < BufferSize ? maxBytes : BufferSize;
+        _maxAge = maxAge;
+    }
+
+    void setTimeout(unsigned long timeout)
+    {
+        _timeout = timeout;
+    }
+
+    /**
+     * @brief Register a callback that is called with the result of every batch (and of every
+     * row that is dropped after it was rejected).
+     */
+    void onResult(PostgrestBatchCallback callback, void *context = nullptr)
+    {
+        _callback = callback;
+        _context = context;
+    }
+
+    /**
+     * @brief Hand batches that fail with a transient error (e.g. no connection) to an offline
+     * queue, which persists them and replays them when the connection is back.
+     * The queue's buffer must be large enough for a full batch.
+     *
+     * @param queue the offline queue, nullptr to keep failed batches in the buffer
+     */
+    void setOfflineQueue(PostgrestOfflineQueue *queue)
+    {
+        _queue = queue;
+    }
+
+    /**
+     * @brief Send the batches as upsert: rows that conflict with existing rows update them
+     * (or are skipped with ignoreDuplicates), so replaying a batch after a reconnect is harmless.
+     * To use a unique constraint other than the primary key, add "?on_conflict=columns" to the route.
+     *
+     * @param enable false to insert (default)
+     * @param ignoreDuplicates true to keep existing rows unchanged instead of merging
+     */
+    void setUpsert(bool enable, bool ignoreDuplicates = false)
+    {
+        _queueVerb = !enable ? "POST" : ignoreDuplicates ? "UPSERT_IGNORE" : "UPSERT";
+        _options.resolution = !enable ? nullptr : ignoreDuplicates ? "ignore-duplicates" : "merge-duplicates";
+    }
+
+    /**
+     * @brief Buffer the row prepared in the client's getJsonRequest() and clear it.
+     * If the buffer is full and cannot be flushed (the flush fails or waits for its retry
+     * delay), the row is not buffered and stays in getJsonRequest(); call add() again later.
+     *
+     * @return const char* nullptr if the row was buffered (and a flush it triggered succeeded),
+     * error message otherwise. Rows of a failed flush stay buffered.
+     */
+    const char *add()
+    {
+        JsonDocument &row = _client.getJsonRequest();
+        bool buffered;
+        const char *error = append(row.as<JsonVariantConst>(), buffered);
+        if (buffered)
+            row.clear();
+        return error;
+    }
+
+    /**
+     * @brief Buffer a row (a JSON object with column names as keys)
+     * If the buffer is full and cannot be flushed (the flush fails or waits for its retry
+     * delay), the row is not buffered; rowCount() does not change then.
+     *
+     * @return const char* nullptr if the row was buffered (and a flush it triggered succeeded),
+     * error message otherwise. Rows of a failed flush stay buffered.
+     */
+    const char *add(JsonVariantConst row)
+    {
+        bool buffered;
+        return append(row, buffered);
+    }
+
+    /**
+     * @brief Call regularly (e.g. from loop()) to flush rows that are older than maxAge.
+     *
+     * @return const char* nullptr if nothing had to be sent or the flush succeeded, error message otherwise
+     */
+    const char *poll()
+    {
+        if (_rows > 0 && _maxAge && millis() - _firstRowTime >= _maxAge)
+            return autoFlush();
+        return nullptr;
+    }
+
+    /**
+     * @brief Send all buffered rows now (ignoring the retry delay of a failed batch)
+     *
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *flush()
+    {
+        if (_rows == 0)
+            return nullptr;
+
+        size_t rows = _rows;
+        _buffer[_used] = ']';
+        const char *error = _client.doSendJson("POST", _route, _buffer, _used + 1, _timeout, &_options);
+        if (!error)
+        {
+            reset();
+            report(nullptr, rows);
+            return nullptr;
+        }
+        if (!_client.lastErrorIsTransient())
+            error = sendRowsSeparately();
+        else if (_queue && !_queue->enqueue(_queueVerb, _route, _buffer, _used + 1))
+        {
+            reset(); // persisted, sent later by the queue
+            return nullptr;
+        }
+        else
+            report(error, rows);
+
+        _lastError = error;
+        if (error)
+            scheduleRetry();
+        else
+            _retryDelay = 0;
+        return error;
+    }
+
+    size_t rowCount() const
+    {
+        return _rows;
+    }
+
+    // bytes of the serialized batch including the enclosing brackets
+    size_t byteCount() const
+    {
+        return _used + 1;
+    }
+
+    /**
+     * @brief Error message of the last failed flush, nullptr if the last flush succeeded
+     */
+    const char *getLastError() const
+    {
+        return _lastError;
+    }
+
+private:
+    // buffered is set to true if the row was copied into the buffer
+    const char *append(JsonVariantConst row, bool &buffered)
+    {
+        buffered = false;
+        size_t length = measureJson(row);
+        // separator + row + closing ']'
+        if (1 + length + 1 + 1 > _maxBytes)
+            return "row too large for batch buffer";
+        if (_used + 1 + length + 1 > _maxBytes)
+        {
+            // make room, but not before the retry delay of a failed batch is over
+            const char *error = autoFlush();
+            if (error)
+                return error;
+        }
+
+        if (_rows > 0)
+            _buffer[_used++] = ',';
+        size_t written = serializeJson(row, _buffer + _used, BufferSize - _used);
+        if (written != length)
+        {
+            if (_rows > 0)
+                _used--; // drop separator
+            return "payload serialization error";
+        }
+        _used += written;
+        buffered = true;
+        if (_rows++ == 0)
+            _firstRowTime = millis();
+
+        if (_rows >= _maxRows || _used + 1 >= _maxBytes)
+            return autoFlush();
+        return nullptr;
+    }
+
+    // flush triggered by a threshold: respects the retry delay after a failure
+    const char *autoFlush()
+    {
+        if (_retryDelay && (long)(millis() - _retryAt) < 0)
+            return _lastError;
+        return flush();
+    }
+
+    void reset()
+    {
+        _rows = 0;
+        _used = 1;
+        _retryDelay = 0;
+        _lastError = nullptr;
+    }
+
+    void report(const char *error, size_t rows)
+    {
+        if (_callback)
+            _callback(error, rows, _context);
+    }
+
+    void scheduleRetry()
+    {
+        if (_retryDelay == 0)
+            _retryDelay = 1000;
+        else if (_retryDelay < 0x80000000UL)
+            _retryDelay *= 2;
+        if (_maxAge && _retryDelay > _maxAge)
+            _retryDelay = _maxAge;
+        _retryAt = millis() + _retryDelay;
+    }
+
+    // end (exclusive) of the JSON value starting at pos
+    size_t rowEnd(size_t pos) const
+    {
+        int depth = 0;
+        bool inString = false;
+        for (; pos < _used; pos++)
+        {
+            char c = _buffer[pos];
+            if (inString)
+            {
+                if (c == '\\')
+                    pos++;
+                else if (c == '"')
+                    inString = false;
+            }
+            else if (c == '"')
+                inString = true;
+            else if (c == '{' || c == '[')
+                depth++;
+            else if (c == '}' || c == ']')
+                depth--;
+            else if (c == ',' && depth == 0)
+                return pos;
+        }
+        return _used;
+    }
+
+    /**
+     * @brief Send the buffered rows one by one after the database rejected the batch.
+     * Accepted and rejected rows are removed from the buffer; after a transient failure the
+     * remaining rows are kept for the next flush.
+     */
+    const char *sendRowsSeparately()
+    {
+        const char *error = nullptr;
+        size_t pos = 1, out = 1, kept = 0, sent = 0;
+        while (pos < _used)
+        {
+            size_t end = rowEnd(pos);
+            bool keep = error != nullptr;
+            if (!keep)
+            {
+                const char *rowError = _client.doSendJson("POST", _route, _buffer + pos, end - pos, _timeout, &_options);
+                if (!rowError)
+                    sent++;
+                else if (!_client.lastErrorIsTransient())
+                    report(rowError, 1);
+                else
+                {
+                    keep = true;
+                    error = rowError;
+                }
+            }
+            if (keep)
+            {
+                if (kept > 0)
+                    _buffer[out++] = ',';
+                memmove(_buffer + out, _buffer + pos, end - pos);
+                out += end - pos;
+                kept++;
+            }
+            pos = end + 1; // skip ','
+        }
+        if (sent)
+            report(nullptr, sent);
+        if (error)
+            report(error, kept);
+
+        _rows = kept;
+        _used = out;
+        return error;
+    }
+
+    PostgrestClient &_client;
+    const char *_route;
+    size_t _maxRows;
+    size_t _maxBytes;
+    unsigned long _maxAge;
+    unsigned long _timeout;
+    size_t _rows;                // buffered rows
+    size_t _used;                // bytes used in _buffer including the leading '['
+    unsigned long _firstRowTime; // millis() when the oldest buffered row was added
+    unsigned long _retryAt;      // millis() before which automatic flushes are skipped after a failure
+    unsigned long _retryDelay;   // 0 after success, doubles with every failed flush
+    PostgrestBatchCallback _callback;
+    void *_context;
+    const char *_lastError;
+    PostgrestOfflineQueue *_queue;
+    const char *_queueVerb;           // verb for the offline queue, "UPSERT..." with setUpsert()
+    PostgrestRequestOptions _options; // resolution set by setUpsert()
+    char _buffer[BufferSize]; // '[' row ',' row ... (the closing ']' is added when sending)
+};
+
+#endif // POSTGRESTBATCH_H
@@ -0,0 +1,260 @@
+#ifndef POSTGRESTBODYSTREAM_H
+#define POSTGRESTBODYSTREAM_H
+#include <Arduino.h>
+#include "PostgrestMetrics.h"
+
+/**
+ * @brief Stream adapter that exposes exactly one HTTP response body of a connection.
+ * The body is framed by Content-Length, by chunked transfer encoding (the chunk framing is
+ * decoded transparently) or by the end of the connection.
+ * Reads stop at the end of the body, so a keep-alive connection stays positioned at the
+ * start of the next response. deserializeJson() can read from it just like from the WiFiClient.
+ */
+class PostgrestBodyStream : public Stream
+{
+public:
+    PostgrestBodyStream() : _source(nullptr), _remaining(0), _mode(FIXED_LENGTH), _chunkState(CHUNK_DONE)
+    {
+#if POSTGREST_METRICS
+        _received = 0;
+#endif
+    }
+
+    /**
+     * @brief Frame a body with a known length (Content-Length header)
+     *
+     * @param source the connection the body is read from
+     * @param length number of body bytes
+     */
+    void beginFixedLength(Stream &source, size_t length)
+    {
+        _source = &source;
+        _remaining = length;
+        _mode = FIXED_LENGTH;
+    }
+
+    /**
+     * @brief Frame a body sent with "Transfer-Encoding: chunked".
+     * The chunk sizes, chunk delimiters and trailers are consumed here, reads return the payload only.
+     *
+     * @param source the connection the body is read from
+     */
+    void beginChunked(Stream &source)
+    {
+        _source = &source;
+        _remaining = 0;
+        _mode = CHUNKED;
+        _chunkState = CHUNK_SIZE;
+    }
+
+    /**
+     * @brief Frame a body that ends when the server closes the connection
+     * (no Content-Length header and no chunked transfer encoding)
+     *
+     * @param source the connection the body is read from
+     */
+    void beginUntilClose(Stream &source)
+    {
+        _source = &source;
+        _remaining = 0;
+        _mode = UNTIL_CLOSE;
+    }
+
+    /**
+     * @brief true if all body bytes have been consumed.
+     * A body framed by connection close is never finished.
+     */
+    bool finished() const
+    {
+        if (_mode == CHUNKED)
+            return _chunkState == CHUNK_DONE;
+        return _mode == FIXED_LENGTH && _remaining == 0;
+    }
+
+    /**
+     * @brief Number of payload bytes that can be read without waiting.
+     * At a chunk boundary this is 1 if the next chunk header has started to arrive.
+     */
+    int available() override
+    {
+        if (!_source || finished())
+            return 0;
+        int avail = _source->available();
+        if (_mode == CHUNKED && _remaining == 0)
+            return avail > 0 ? 1 : 0;
+        if (_mode != UNTIL_CLOSE && (size_t)avail > _remaining)
+            avail = (int)_remaining;
+        return avail;
+    }
+
+    int read() override
+    {
+        if (!nextByteAvailable())
+            return -1;
+        int c = _source->read();
+#if POSTGREST_METRICS
+        if (c >= 0)
+            _received++;
+#endif
+        if (c >= 0 && _mode != UNTIL_CLOSE)
+        {
+            if (--_remaining == 0 && _mode == CHUNKED)
+                _chunkState = CHUNK_END; // CRLF after the chunk data
+        }
+        return c;
+    }
+
+    int peek() override
+    {
+        if (!nextByteAvailable())
+            return -1;
+        return _source->peek();
+    }
+
+    size_t write(uint8_t) override
+    {
+        return 0; // read-only
+    }
+
+    /**
+     * @brief Skip the rest of the body so the next response can be read.
+     *
+     * @return true if the body was consumed completely
+     * @return false if the server stopped sending (timeout) or the body is framed by connection close
+     */
+    bool drain()
+    {
+        if (!_source || _mode == UNTIL_CLOSE)
+            return false;
+        char buf[32];
+        while (!finished())
+        {
+            if (!nextByteAvailable())
+                return finished();
+            size_t n = _remaining < sizeof(buf) ? _remaining : sizeof(buf);
+            size_t got = _source->readBytes(buf, n);
+            if (got == 0)
+                return false;
+#if POSTGREST_METRICS
+            _received += got;
+#endif
+            _remaining -= got;
+            if (_remaining == 0 && _mode == CHUNKED)
+                _chunkState = CHUNK_END;
+        }
+        return true;
+    }
+
+#if POSTGREST_METRICS
+    /**
+     * @brief Bytes read from the sources of all bodies so far, chunk framing included.
+     * Wraps around; the difference of two values is the traffic in between.
+     */
+    uint32_t received() const
+    {
+        return _received;
+    }
+#endif
+
+private:
+    enum Mode
+    {
+        FIXED_LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE
+    };
+
+    enum ChunkState
+    {
+        CHUNK_SIZE, // next is a chunk size line
+        CHUNK_DATA, // _remaining bytes of chunk data follow
+        CHUNK_END,  // CRLF after chunk data follows
+        CHUNK_DONE  // last chunk and trailers consumed
+    };
+
+    // read one byte of the framing, waiting up to the source's timeout; -1 on timeout
+    int readFramingByte()
+    {
+        char c;
+        if (_source->readBytes(&c, 1) != 1)
+            return -1;
+#if POSTGREST_METRICS
+        _received++;
+#endif
+        return (unsigned char)c;
+    }
+
+    // consume the rest of the current line, false on timeout
+    bool skipLine()
+    {
+        int c;
+        do
+        {
+            c = readFramingByte();
+        } while (c >= 0 && c != '\n');
+        return c >= 0;
+    }
+
+    /**
+     * @brief Make sure the next byte read from the source is payload, parsing chunk
+     * framing as needed. Chunk framing is read blocking up to the source's timeout.
+     *
+     * @return true payload bytes remain
+     * @return false end of the body, or the framing could not be read (the body is then finished)
+     */
+    bool nextByteAvailable()
+    {
+        if (!_source || finished())
+            return false;
+        if (_mode != CHUNKED || _chunkState == CHUNK_DATA)
+            return true;
+
+        if (_chunkState == CHUNK_END && !skipLine())
+        {
+            _chunkState = CHUNK_DONE;
+            return false;
+        }
+        // chunk size in hex, optionally followed by ";extensions"
+        size_t size = 0;
+        int digits = 0;
+        int c = readFramingByte();
+        while (c >= 0 && isxdigit(c))
+        {
+            size = size * 16 + (size_t)(isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            digits++;
+            c = readFramingByte();
+        }
+        if (c < 0 || digits == 0 || (c != '\n' && !skipLine()))
+        {
+            _chunkState = CHUNK_DONE;
+            return false;
+        }
+        if (size == 0)
+        {
+            // last chunk: skip trailers up to the empty line
+            while (true)
+            {
+                c = readFramingByte();
+                if (c == '\r')
+                    c = readFramingByte();
+                if (c < 0 || c == '\n' || !skipLine())
+                    break;
+            }
+            _chunkState = CHUNK_DONE;
+            return false;
+        }
+        _remaining = size;
+        _chunkState = CHUNK_DATA;
+        return true;
+    }
+
+    Stream *_source;
+    size_t _remaining; // body bytes (fixed length) or bytes of the current chunk not yet read
+    Mode _mode;
+    ChunkState _chunkState;
+#if POSTGREST_METRICS
+    uint32_t _received;
+#endif
+};
+
+#endif // POSTGRESTBODYSTREAM_H
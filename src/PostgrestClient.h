@@ -3,19 +3,119 @@
 #include <ArduinoJson.h>
 #include "WiFiClient.h"
 #include <cstring>
+#include <utility>
+#include "PostgrestBodyStream.h"
+#include "PostgrestWriteBuffer.h"
+#include "PostgrestCredential.h"
+#include "PostgrestArena.h"
+#include "PostgrestQuery.h"
+#include "PostgrestCsv.h"
+#include "PostgrestInflate.h"
+#include "PostgrestMetrics.h"
+#include "PostgrestRetry.h"
+#include "PostgrestDnsCache.h"
+#include "PostgrestTlsSessions.h"
+#include "PostgrestResponseCache.h"
 
 // need to decode base64 encoded JWT tokens
 #define BASE64_URL
 #include <base64.hpp>
 
+// upper limit for tokens and session cookies; they are stored in heap blocks sized to fit
 #ifndef MAX_JWT_LENGTH
 #define MAX_JWT_LENGTH 8192
 #endif
 
+// requests are collected in a buffer of this size and sent in as few writes as possible
+#ifndef POSTGREST_WRITE_BUFFER_SIZE
+#define POSTGREST_WRITE_BUFFER_SIZE 1024
+#endif
+
+// requests doGetPipelined() sends before it reads their responses
+#ifndef POSTGREST_PIPELINE_DEPTH
+#define POSTGREST_PIPELINE_DEPTH 8
+#endif
+
 #define ERROR_NOT_SIGNED_IN "Not signed in"
 
 uint32_t jwt_get_claim_u32_scan(const char *jwt, const char *claim); // see implementation below
 
+class PostgrestAsyncRequest;
+
+/**
+ * @brief Memory used by a PostgrestClient, see PostgrestClient::getMemoryStats()
+ * The JSON documents (getJsonRequest(), getJsonResult()) are not included.
+ */
+struct PostgrestMemoryStats
+{
+    size_t clientSize;      // size of the client object (static RAM if it is a global)
+    size_t credentialHeap;  // heap for the token and the session cookie or refresh token
+    size_t headerBlockHeap; // heap for the prebuilt data API headers (contains the token)
+    size_t inflateHeap;     // heap for gzip decompression, see setCompression()
+};
+
+/**
+ * @brief Preferences of a single data API request, sent as Prefer header
+ * (see https://docs.postgrest.org/en/stable/references/api/preferences.html).
+ * Members left at nullptr/false are not sent, so the server default applies.
+ *
+ * Usage:
+ *   PostgrestRequestOptions minimal("minimal");
+ *   pgClient.doPost("/sensorvalues", 20000, &minimal);
+ */
+struct PostgrestRequestOptions
+{
+    const char *returnMode; // "minimal", "headers-only" or "representation" (rows are returned in getJsonResult())
+    const char *count;      // "exact", "planned" or "estimated": total rows in getContentRangeTotal()
+    bool missingDefault;    // missing=default: columns missing in the payload get their default value
+    const char *resolution; // "merge-duplicates" or "ignore-duplicates": POST inserts as upsert, see doUpsert()
+    const char *idempotencyKey; // sent as Idempotency-Key header; allows retries of POST and PATCH, see setRetryPolicy()
+
+    PostgrestRequestOptions(const char *returnMode = nullptr, const char *count = nullptr, bool missingDefault = false,
+                            const char *resolution = nullptr, const char *idempotencyKey = nullptr)
+        : returnMode(returnMode), count(count), missingDefault(missingDefault), resolution(resolution), idempotencyKey(idempotencyKey) {}
+
+    // true if the response contains the affected rows
+    bool returnsRows() const
+    {
+        return returnMode && strcmp(returnMode, "representation") == 0;
+    }
+};
+
+/**
+ * @brief CSV body of PostgrestClient::doPostCsv(): header line and row callback
+ */
+struct PostgrestCsvSource
+{
+    const char *columns;
+    PostgrestCsvRowCallback callback;
+    void *context;
+    bool chunked; // send with chunked transfer encoding instead of measuring the body first
+};
+
+/**
+ * @brief One query of PostgrestClient::doGetPipelined(): route in, result and status out
+ */
+struct PostgrestPipelinedGet
+{
+    const char *route;    // like for doGet, e.g. "/settings?device=eq.7"
+    JsonDocument *result; // receives the parsed response, nullptr to discard it
+    const char *error;    // nullptr on success, error message otherwise
+    int statusCode;       // HTTP status, 0 if no response was received
+
+    PostgrestPipelinedGet(const char *route = nullptr, JsonDocument *result = nullptr)
+        : route(route), result(result), error(nullptr), statusCode(0) {}
+};
+
+/**
+ * @brief Callback for rows streamed by PostgrestClient::doGetEach()
+ *
+ * @param row the current row, valid until the callback returns
+ * @param context pointer passed to doGetEach()
+ * @return true to continue with the next row, false to stop
+ */
+typedef bool (*PostgrestRowCallback)(JsonVariantConst row, void *context);
+
 /**
  * @brief A base class for PostgrestClient implementations for different vendors.
  * Postgrest is a PostgreSQL extension providing a RESTful API interface to Postgres databases.
@@ -26,8 +126,17 @@ uint32_t jwt_get_claim_u32_scan(const char *jwt, const char *claim); // see impl
  */
 class PostgrestClient
 {
+    // uses the host, token and header block for its own connection
+    friend class PostgrestAsyncRequest;
+
 public:
-    virtual ~PostgrestClient() {}
+    virtual ~PostgrestClient()
+    {
+        free(_headerBlock);
+    }
+
+    PostgrestClient(const PostgrestClient &) = delete;
+    PostgrestClient &operator=(const PostgrestClient &) = delete;
 
     // Vendor-specific operations: default to not implemented
     virtual const char *signUp(const char *name, const char *email, const char *password, unsigned long timeout = 20000)
@@ -59,8 +168,8 @@ public:
     virtual void printJwt()
     {
         Serial.print("JWT: ");
-        if (_jwtBuffer[0])
-            Serial.println(_jwtBuffer);
+        if (!_jwt.empty())
+            Serial.println(_jwt.c_str());
         else
             Serial.println("<none>");
         Serial.print("token lifetime (s): ");
@@ -73,6 +182,110 @@ public:
         Serial.println(_tokenExpiry - (millis() - _internalTimeIat) / 1000U);
     }
 
+    /**
+     * @brief Memory used by the client: the object itself and the heap blocks for credentials
+     * and headers, which are sized to the actual token instead of MAX_JWT_LENGTH.
+     */
+    virtual PostgrestMemoryStats getMemoryStats() const
+    {
+        PostgrestMemoryStats stats;
+        stats.clientSize = sizeof(PostgrestClient);
+        stats.credentialHeap = _jwt.heapSize();
+        stats.headerBlockHeap = _headerBlock ? _headerBlockLength + 1 : 0;
+        stats.inflateHeap = _inflate.heapSize();
+        return stats;
+    }
+
+    /**
+     * @brief Print getMemoryStats() to Serial for debugging
+     */
+    void printMemoryStats() const
+    {
+        PostgrestMemoryStats stats = getMemoryStats();
+        Serial.print("client object (bytes): ");
+        Serial.println((unsigned long)stats.clientSize);
+        Serial.print("credentials on heap (bytes): ");
+        Serial.println((unsigned long)stats.credentialHeap);
+        Serial.print("header block on heap (bytes): ");
+        Serial.println((unsigned long)stats.headerBlockHeap);
+        Serial.print("gzip decompression on heap (bytes): ");
+        Serial.println((unsigned long)stats.inflateHeap);
+        Serial.print("total (bytes): ");
+        Serial.println((unsigned long)(stats.clientSize + stats.credentialHeap + stats.headerBlockHeap + stats.inflateHeap));
+    }
+
+#if POSTGREST_METRICS
+    /**
+     * @brief Have the metrics of every request (data API and auth) passed to a callback, e.g. to
+     * log slow requests or to find out where the time of a slow upload goes.
+     * Totals over all requests are kept without a callback, see getMetricsTotals().
+     *
+     * @param callback called when a request is complete, nullptr to stop
+     * @param context passed to the callback
+     */
+    void onRequestMetrics(PostgrestMetricsCallback callback, void *context = nullptr)
+    {
+        _metricsCallback = callback;
+        _metricsContext = context;
+    }
+
+    // metrics of the last completed request
+    const PostgrestRequestMetrics &getLastRequestMetrics() const
+    {
+        return _metrics;
+    }
+
+    const PostgrestMetricsTotals &getMetricsTotals() const
+    {
+        return _metricsTotals;
+    }
+
+    void resetMetricsTotals()
+    {
+        _metricsTotals = PostgrestMetricsTotals();
+    }
+
+    /**
+     * @brief Print getMetricsTotals() to Serial: counters and the average time of each phase
+     */
+    void printMetricsTotals() const
+    {
+        const PostgrestMetricsTotals &t = _metricsTotals;
+        Serial.print("requests: ");
+        Serial.print((unsigned long)t.requests);
+        Serial.print(" (failed ");
+        Serial.print((unsigned long)t.failures);
+        Serial.print(", retries ");
+        Serial.print((unsigned long)t.retries);
+        Serial.print(", token refreshes ");
+        Serial.print((unsigned long)t.tokenRefreshes);
+        Serial.print(", kept-alive ");
+        Serial.print((unsigned long)t.reused);
+        Serial.print(", TLS resumed ");
+        Serial.print((unsigned long)t.tlsResumed);
+        Serial.println(")");
+        if (t.requests == 0)
+            return;
+        double n = t.requests * 1000.0; // averages in milliseconds
+        Serial.print("average ms: connect ");
+        Serial.print(t.connectTime / n, 1);
+        Serial.print(", send ");
+        Serial.print(t.sendTime / n, 1);
+        Serial.print(", wait ");
+        Serial.print(t.waitTime / n, 1);
+        Serial.print(", headers ");
+        Serial.print(t.headerTime / n, 1);
+        Serial.print(", body ");
+        Serial.println(t.bodyTime / n, 1);
+        Serial.print("longest request (ms): ");
+        Serial.println(t.maxTime / 1000.0, 1);
+        Serial.print("average bytes sent/received: ");
+        Serial.print((unsigned long)(t.bytesSent / t.requests));
+        Serial.print("/");
+        Serial.println((unsigned long)(t.bytesReceived / t.requests));
+    }
+#endif
+
     /**
      * @brief Get the Json Request object (ArduinoJson JsonDocument) to set the REST API request
      * payload according to the
@@ -97,6 +310,32 @@ public:
         return response;
     }
 
+    /**
+     * @brief Back getJsonRequest() and getJsonResult() with one fixed arena instead of the heap.
+     * Sharing works because the request payload is released as soon as it has been sent,
+     * before the response is parsed. Call before signIn(): both documents are emptied.
+     * A request or response that does not fit fails with an error, see PostgrestArena::highWaterMark()
+     * to size the arena.
+     *
+     * @param arena memory for both documents, must outlive the client
+     */
+    void useArena(PostgrestArena &arena)
+    {
+        useArenas(arena, arena);
+    }
+
+    /**
+     * @brief Back getJsonRequest() and getJsonResult() with separate arenas, e.g. a small one for
+     * request payloads and a large one for query results.
+     * Call before signIn(): both documents are emptied.
+     */
+    void useArenas(PostgrestArena &requestArena, PostgrestArena &responseArena)
+    {
+        request = JsonDocument(&requestArena);
+        response = JsonDocument(&responseArena);
+        _requestArena = &requestArena;
+    }
+
     /**
      * @brief query the given route and return results in getJsonResult()
      * all routes must start with a leading '/'
@@ -107,25 +346,330 @@ public:
      *
      * @param route
      * @param timeout
+     * @param options Prefer header, e.g. count
      * @return const char* nullptr on success, error message in case of failure
      */
-    const char *doGet(const char *route, unsigned long timeout = 20000)
+    const char *doGet(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
+        // options change the response (e.g. its headers), so only plain queries are cached
+        bool cacheable = _cache && !options;
+        if (cacheable && _cache->lookup(route, response))
+            return nullptr;
         const char *error = refreshTokenIfNeeded();
 
         if (error)
             return error;
         response.clear();
+        _options = options;
         error = invokeDataAPI("GET", route, timeout, true);
         request.clear();
         if (error)
             return error;
 
+        if (cacheable)
+            _cache->store(route, response);
         return nullptr;
     }
 
+    /**
+     * @brief query the given route and keep only the fields selected by filter in getJsonResult().
+     * Other fields are dropped while the response is parsed, which saves memory and time for
+     * wide rows (if possible, also restrict the columns with "select=" in the route).
+     * Filter syntax: see https://arduinojson.org/v7/api/json/deserializejson/ (Filter), e.g. for rows
+     *   JsonDocument filter;
+     *   filter[0]["sensor_value"] = true;
+     *
+     * @param route
+     * @param filter fields to keep, true for each wanted field
+     * @param timeout
+     * @param nestingLimit maximum depth of nested arrays/objects accepted in the response
+     * @param options Prefer header, e.g. count
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doGet(const char *route, JsonVariantConst filter, unsigned long timeout = 20000,
+                      uint8_t nestingLimit = ARDUINOJSON_DEFAULT_NESTING_LIMIT, const PostgrestRequestOptions *options = nullptr)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        response.clear();
+        _options = options;
+        error = invokeDataAPI("GET", route, timeout, true, nullptr, 0, filter, nestingLimit);
+        request.clear();
+        return error;
+    }
+
+    /**
+     * @brief query one page of rows of the given route into getJsonResult(), using the
+     * Range header so the server sends at most rows rows starting at offset.
+     * getContentRangeFirst()/Last()/Total() return the range in the response.
+     * Use an "order=" in the route so pages are stable. See also PostgrestPager.
+     *
+     * @param route
+     * @param offset index of the first row (0 based)
+     * @param rows number of rows in the page
+     * @param count nullptr, or "exact", "planned" or "estimated" to have the server count all rows
+     *   (Prefer: count=...); "estimated" is cheap on large tables
+     * @param timeout
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doGetPage(const char *route, unsigned long offset, unsigned long rows, const char *count = nullptr, unsigned long timeout = 20000)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        if (rows == 0)
+            return "page size must not be 0";
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        response.clear();
+        _rangeFirst = (long)offset;
+        _rangeLast = (long)(offset + rows - 1);
+        PostgrestRequestOptions options(nullptr, count);
+        _options = &options;
+        error = invokeDataAPI("GET", route, timeout, true);
+        _rangeFirst = -1;
+        request.clear();
+        return error;
+    }
+
+    // first row index in the Content-Range of the last response, -1 if none or empty
+    long getContentRangeFirst() const
+    {
+        return _contentRangeFirst;
+    }
+
+    // last row index in the Content-Range of the last response, -1 if none or empty
+    long getContentRangeLast() const
+    {
+        return _contentRangeLast;
+    }
+
+    // total number of rows in the Content-Range of the last response, -1 if not counted
+    long getContentRangeTotal() const
+    {
+        return _contentRangeTotal;
+    }
+
+    /**
+     * @brief HEAD request: like doGet, but the server sends the headers only.
+     * With a count option this counts rows without transferring them:
+     *   PostgrestRequestOptions count(nullptr, "exact");
+     *   error = pgClient.doHead("/sensorvalues?sensor_name=eq.temperature", &count);
+     *   long rows = pgClient.getContentRangeTotal();
+     *
+     * @param route
+     * @param options Prefer header, typically count
+     * @param timeout
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doHead(const char *route, const PostgrestRequestOptions *options, unsigned long timeout = 20000)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        _options = options;
+        error = invokeDataAPI("HEAD", route, timeout, false);
+        request.clear();
+        return error;
+    }
+
+    /**
+     * @brief query the given route and hand the rows to callback one at a time while they are received
+     * Unlike doGet the result is never held in memory completely: each row is parsed from the
+     * connection into getJsonResult() (which is cleared before every row), so memory stays
+     * constant regardless of the number of rows.
+     * route is like for doGet, e.g. "/sensorvalues?sensor_name=eq.temperature"
+     *
+     * @param route
+     * @param callback called for every row, return false to stop early
+     * @param context passed to callback
+     * @param timeout
+     * @param options Prefer header, e.g. count
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doGetEach(const char *route, PostgrestRowCallback callback, void *context = nullptr, unsigned long timeout = 20000,
+                          const PostgrestRequestOptions *options = nullptr)
+    {
+        const char *error = beginRows(route, timeout, options);
+        if (error)
+            return error;
+        while (nextRow())
+        {
+            if (!callback(response.as<JsonVariantConst>(), context))
+                break;
+        }
+        return endRows();
+    }
+
+    /**
+     * @brief run several queries with HTTP pipelining: the requests are written to one connection
+     * back to back, then the responses are read in order, so the queries take about one round
+     * trip instead of one each (e.g. loading several configuration tables at boot).
+     * If the server closes the connection before it answered all of them (servers limit the
+     * requests per connection), the unanswered ones are sent again on a new connection.
+     * Failed connections and queries with a server error (5xx, 408, 429) are retried as set by
+     * setRetryPolicy(); the retries of all queries count against one deadline.
+     * Usage:
+     *   JsonDocument settings, sensors;
+     *   PostgrestPipelinedGet gets[] = {{"/settings?device=eq.7", &settings}, {"/sensors?device=eq.7", &sensors}};
+     *   error = pgClient.doGetPipelined(gets, 2);
+     *
+     * @param gets queries; result, error and statusCode of each are set
+     * @param count number of queries
+     * @param timeout milliseconds to wait for each response
+     * @return const char* nullptr if all queries succeeded, the first error otherwise
+     */
+    const char *doGetPipelined(PostgrestPipelinedGet *gets, size_t count, unsigned long timeout = 20000)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        if (count == 0)
+            return nullptr;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        _options = nullptr;
+        beginMetrics(false, "GET", gets[0].route); // the pipeline counts as one request
+        unsigned long started = millis();
+        uint8_t retries[PostgrestRetryPolicy::NOT_RETRYABLE] = {};
+        bool opened = false;
+        for (size_t first = 0; first < count; first += POSTGREST_PIPELINE_DEPTH)
+        {
+            size_t pending[POSTGREST_PIPELINE_DEPTH];
+            size_t waiting = 0;
+            for (size_t i = first; i < count && waiting < POSTGREST_PIPELINE_DEPTH; i++)
+                pending[waiting++] = i;
+            pipelineGets(gets, pending, waiting, timeout, started, retries, opened);
+        }
+        if (_connectedHost)
+            releaseConnection(true);
+        request.clear();
+        error = nullptr;
+        for (size_t i = 0; i < count && !error; i++)
+            error = gets[i].error;
+        return endMetrics(error);
+    }
+
+    /**
+     * @brief query the given route and read the resulting rows one at a time with nextRow()
+     * Iterator variant of doGetEach: memory stays constant regardless of the number of rows.
+     * Usage:
+     *   const char *error = pgClient.beginRows("/sensorvalues?order=measure_time.desc");
+     *   while (!error && pgClient.nextRow())
+     *   {
+     *       JsonDocument &row = pgClient.getJsonResult();
+     *       ...
+     *   }
+     *   error = pgClient.endRows(); // always call endRows(), even if you stop early
+     *
+     * @param route
+     * @param timeout
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *beginRows(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
+    {
+        if (_rowsOpen)
+            endRows();
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        response.clear();
+        _options = options;
+        error = requestDataAPI("GET", route, timeout, nullptr, 0);
+        request.clear();
+        if (error)
+            return error;
+
+        openResponseBody();
+        _rowsOpen = true;
+        _rowsDone = false;
+        _rowsError = nullptr;
+        _rowsRead = 0;
+        // a JSON array of rows, or a single object (e.g. Accept: application/vnd.pgrst.object+json)
+        int c = peekRowStream();
+        _rowsSingle = c == '{';
+        if (c == '[')
+            responseStream().read();
+        else if (!_rowsSingle)
+        {
+            _rowsError = "Invalid response";
+            _rowsDone = true;
+        }
+        return _rowsError;
+    }
+
+    /**
+     * @brief parse the next row of the query started with beginRows() into getJsonResult()
+     *
+     * @return true a row is available in getJsonResult()
+     * @return false no more rows or an error occurred (see endRows())
+     */
+    bool nextRow()
+    {
+        if (!_rowsOpen || _rowsDone)
+            return false;
+        response.clear();
+        if (_rowsSingle && _rowsRead > 0)
+        {
+            _rowsDone = true;
+            return false;
+        }
+        int c = peekRowStream();
+        if (!_rowsSingle)
+        {
+            if (c == ',' && _rowsRead > 0)
+            {
+                responseStream().read();
+                c = peekRowStream();
+            }
+            if (c == ']')
+            {
+                responseStream().read();
+                _rowsDone = true;
+                return false;
+            }
+        }
+        if (c < 0)
+        {
+            _rowsError = "incomplete response";
+            _rowsDone = true;
+            return false;
+        }
+        DeserializationError err = deserializeJson(response, responseStream());
+        if (err)
+        {
+            _rowsError = jsonError(err);
+            _rowsDone = true;
+            return false;
+        }
+        _rowsRead++;
+        return true;
+    }
+
+    /**
+     * @brief finish the query started with beginRows()
+     *
+     * @return const char* nullptr if all rows were read without error, error message otherwise
+     */
+    const char *endRows()
+    {
+        if (!_rowsOpen)
+            return _rowsError;
+        _rowsOpen = false;
+        // skipping the rest of a query that was stopped early could mean downloading a large table
+        closeResponseBody(_rowsDone && !_rowsError);
+        return endMetrics(_rowsError);
+    }
+
     /**
      * @brief insert tuples
      * post the given route with payload from getJsonRequest()
@@ -134,16 +678,17 @@ public:
      * see https://docs.postgrest.org/en/stable/references/api/tables_views.html
      * @param route
      * @param timeout
+     * @param options Prefer header; with returnMode "representation" the inserted rows are returned in getJsonResult()
      * @return const char* nullptr on success, error message in case of failure
      */
-    const char *doPost(const char *route, unsigned long timeout = 20000)
+    const char *doPost(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
         const char *error = refreshTokenIfNeeded();
         if (error)
             return error;
-        error = invokeDataAPI("POST", route, timeout, false);
+        error = invokeWithOptions("POST", route, timeout, options);
         request.clear();
         if (error)
             return error;
@@ -151,6 +696,74 @@ public:
         return nullptr;
     }
 
+    /**
+     * @brief insert tuples or update the existing ones with the same key (upsert)
+     * post the given route with payload from getJsonRequest(), a single row or an array of rows.
+     * Rows that conflict with an existing row are merged into it, or skipped with ignoreDuplicates,
+     * so re-sending the same state after a reconnect is not an error.
+     * see https://docs.postgrest.org/en/stable/references/api/tables_views.html#upsert
+     * @param route table like "/devices"
+     * @param onConflict comma separated columns of a unique constraint, nullptr for the primary key
+     * @param ignoreDuplicates true to keep existing rows unchanged instead of merging
+     * @param timeout
+     * @param options further Prefer header options, e.g. returnMode "minimal"
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doUpsert(const char *route, const char *onConflict = nullptr, bool ignoreDuplicates = false, unsigned long timeout = 20000,
+                         const PostgrestRequestOptions *options = nullptr)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        PostgrestRequestOptions upsert = options ? *options : PostgrestRequestOptions();
+        upsert.resolution = ignoreDuplicates ? "ignore-duplicates" : "merge-duplicates";
+        _onConflict = onConflict;
+        error = invokeWithOptions("POST", route, timeout, &upsert);
+        request.clear();
+        return error;
+    }
+
+    /**
+     * @brief insert tuples sent as CSV instead of JSON
+     * The rows are written by callback directly to the connection, so no JsonDocument is needed
+     * for the batch, and column names are sent once in the header line instead of in every row.
+     * Usage:
+     *   bool writeRow(PostgrestCsvWriter &csv, size_t row, void *context)
+     *   {
+     *       if (row >= sampleCount)
+     *           return false;
+     *       csv.field("temperature").field(samples[row], 1);
+     *       return true;
+     *   }
+     *   error = pgClient.doPostCsv("/sensorvalues", "sensor_name,sensor_value", writeRow);
+     *
+     * @param route table like "/sensorvalues"
+     * @param columns header line, column names separated by commas
+     * @param callback writes one row per call, see PostgrestCsvRowCallback
+     * @param context passed to callback
+     * @param chunked false: the rows are written twice, to measure Content-Length and to send them;
+     *   true: the rows are written once with chunked transfer encoding (for rows that can't be repeated cheaply)
+     * @param timeout
+     * @param options Prefer header, e.g. returnMode "minimal"
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doPostCsv(const char *route, const char *columns, PostgrestCsvRowCallback callback, void *context = nullptr,
+                          bool chunked = false, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        PostgrestCsvSource csv = {columns, callback, context, chunked};
+        _csv = &csv;
+        error = invokeWithOptions("POST", route, timeout, options);
+        request.clear();
+        return error;
+    }
+
     /**
      * @brief call a function in Postgres
      * post the given route with payload from getJsonRequest() and return results in getJsonResult().
@@ -160,15 +773,17 @@ public:
      * see https://docs.postgrest.org/en/stable/references/api/tables_views.html
      * @param route
      * @param timeout
+     * @param options Prefer header
      * @return const char* nullptr on success, error message in case of failure
      */
-    const char *doPostRPC(const char *route, unsigned long timeout = 20000)
+    const char *doPostRPC(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
         const char *error = refreshTokenIfNeeded();
         if (error)
             return error;
+        _options = options;
         error = invokeDataAPI("POST", route, timeout, true);
         request.clear();
         if (error)
@@ -177,25 +792,50 @@ public:
         return nullptr;
     }
 
+    /**
+     * @brief call a function in Postgres like doPostRPC() and keep only the fields selected by
+     * filter in getJsonResult(); the rest of a verbose result is dropped while it is parsed.
+     * @param route
+     * @param filter fields to keep, see doGet(route, filter)
+     * @param timeout
+     * @param nestingLimit maximum depth of nested arrays/objects accepted in the response
+     * @param options Prefer header
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doPostRPC(const char *route, JsonVariantConst filter, unsigned long timeout = 20000,
+                          uint8_t nestingLimit = ARDUINOJSON_DEFAULT_NESTING_LIMIT, const PostgrestRequestOptions *options = nullptr)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        _options = options;
+        error = invokeDataAPI("POST", route, timeout, true, nullptr, 0, filter, nestingLimit);
+        request.clear();
+        return error;
+    }
+
     /**
      * @brief update tuples
-     * patch the given route with payload from getJsonRequest() and return results in getJsonResult()
+     * patch the given route with payload from getJsonRequest()
      * all routes must start with a leading '/'.
      * route can be like
      * update item with id=5: "/item?id=eq.5"
      * see https://docs.postgrest.org/en/stable/references/api/tables_views.html
      * @param route
      * @param timeout
+     * @param options Prefer header; with returnMode "representation" the updated rows are returned in getJsonResult()
      * @return const char* nullptr on success, error message in case of failure
      */
-    const char *doPatch(const char *route, unsigned long timeout = 20000)
+    const char *doPatch(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
         const char *error = refreshTokenIfNeeded();
         if (error)
             return error;
-        error = invokeDataAPI("PATCH", route, timeout, false);
+        error = invokeWithOptions("PATCH", route, timeout, options);
         request.clear();
         if (error)
             return error;
@@ -205,22 +845,23 @@ public:
 
     /**
      * @brief delete tuples
-     * delete the given route and return results in getJsonResult()
+     * delete the given route
      * all routes must start with a leading '/'.
      * route can be like delete item with id=5: "/item?id=eq.5"
      * see https://docs.postgrest.org/en/stable/references/api/tables_views.html
      * @param route
      * @param timeout
+     * @param options Prefer header; with returnMode "representation" the deleted rows are returned in getJsonResult()
      * @return const char* nullptr on success, error message in case of failure
      */
-    const char *doDelete(const char *route, unsigned long timeout = 20000)
+    const char *doDelete(const char *route, unsigned long timeout = 20000, const PostgrestRequestOptions *options = nullptr)
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
         const char *error = refreshTokenIfNeeded();
         if (error)
             return error;
-        error = invokeDataAPI("DELETE", route, timeout, false);
+        error = invokeWithOptions("DELETE", route, timeout, options);
         request.clear();
         if (error)
             return error;
@@ -228,67 +869,375 @@ public:
         return nullptr;
     }
 
-protected:
-    // base constructor: only subclasses should create concrete clients
-    PostgrestClient(WiFiClient &client) : _client(client), _authHost(nullptr), _authPath(nullptr), _apiHost(nullptr), _port(443), _apiPath(nullptr), _email(nullptr), _password(nullptr), _isSignedIn(false), _tokenExpiry(0), _internalTimeIat(0)
-    {
-        request.clear();
-        response.clear();
-        _status[0] = '\0';
-        _jwtBuffer[0] = '\0';
+    /**
+     * @brief send an already serialized JSON payload instead of getJsonRequest()
+     * Avoids building a JsonDocument for payloads that are kept in serialized form anyway,
+     * e.g. the rows collected by PostgrestBatch.
+     * all routes must start with a leading '/'.
+     * @param verb "POST", "PATCH" or "DELETE"
+     * @param route
+     * @param json serialized JSON payload (need not be null terminated)
+     * @param length number of bytes in json
+     * @param timeout
+     * @param options Prefer header; with returnMode "representation" the affected rows are returned in getJsonResult()
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *doSendJson(const char *verb, const char *route, const char *json, size_t length, unsigned long timeout = 20000,
+                           const PostgrestRequestOptions *options = nullptr)
+    {
+        if (!_isSignedIn)
+            return ERROR_NOT_SIGNED_IN;
+        const char *error = refreshTokenIfNeeded();
+        if (error)
+            return error;
+        return invokeWithOptions(verb, route, timeout, options, json, length);
+    }
+
+    /**
+     * @brief Keep the connection to the data API open between requests (HTTP/1.1 keep-alive).
+     * Without keep-alive every doGet/doPost/... connects to the data API host and closes the
+     * connection afterwards, which costs a full TCP and TLS handshake per request.
+     * With keep-alive the connection is reused as long as
+     * - the server did not answer with "Connection: close",
+     * - it was not idle for longer than idleTimeout (or the server's Keep-Alive timeout) and
+     * - the server did not close it in the meantime.
+     * Otherwise a new connection is opened transparently. If a reused connection turns out to be
+     * closed by the server before any response byte was received, the request is sent once more
+     * on a new connection.
+     * Requests to the auth service use the same connection when it runs on the same host
+     * (e.g. Supabase), otherwise the connection is switched between the two hosts.
+     *
+     * @param enable true to reuse connections, false to close the connection after each request
+     * @param idleTimeout milliseconds an unused connection is kept for reuse
+     */
+    void setKeepAlive(bool enable, unsigned long idleTimeout = 30000)
+    {
+        _keepAlive = enable;
+        _keepAliveIdleTimeout = idleTimeout;
+        if (!enable)
+            closeConnection();
+    }
+
+    /**
+     * @brief Ask the data API for gzip compressed responses (Accept-Encoding: gzip) and
+     * decompress them while they are parsed. JSON typically shrinks 5-10x, which saves time on
+     * slow links. Decompression needs POSTGREST_INFLATE_WINDOW (32 KB) plus about 1.2 KB of heap,
+     * allocated here and reported by getMemoryStats().
+     * Whether responses are compressed depends on the server: PostgREST itself doesn't compress,
+     * a reverse proxy in front of it (e.g. nginx, Cloudflare) does.
+     *
+     * @param enable true to request compressed responses, false to free the memory again
+     * @return false if the memory could not be allocated; compression stays disabled
+     */
+    bool setCompression(bool enable)
+    {
+        if (!enable)
+            _inflate.release();
+        else
+            _inflate.allocate();
+        _compression = enable && _inflate.heapSize() > 0;
+        return _compression == enable;
+    }
+
+    /**
+     * @brief Connect to cached addresses of the auth and data API hosts instead of resolving
+     * their names for every connection, see PostgrestDnsCache. The Host header (and SNI, if the
+     * cache's connector passes it on) still carry the host name. The cache may be shared by
+     * several clients and must stay valid while it is set.
+     *
+     * @param cache address cache, nullptr to let the WiFi client resolve host names
+     */
+    void setDnsCache(PostgrestDnsCache *cache)
+    {
+        _dns = cache;
+    }
+
+    /**
+     * @brief Resume TLS sessions when reconnecting to the auth and data API hosts, which saves a
+     * round trip and the public key operations of a full handshake (time and battery). Useful
+     * without keep-alive, or when the server closes idle connections. Whether a connection
+     * resumed its session is reported by connectionResumed() and in the request metrics.
+     *
+     * @param sessions session store of the TLS client passed to the constructor, e.g.
+     * PostgrestBearSSLSessions on ESP8266; nullptr for full handshakes
+     */
+    void setTlsSessions(PostgrestTlsSessionStore *sessions)
+    {
+        _tlsSessions = sessions;
+        _tlsResumed = false;
+    }
+
+    // true if the TLS handshake of the current connection resumed a session, see setTlsSessions()
+    bool connectionResumed() const
+    {
+        return _tlsResumed;
+    }
+
+    /**
+     * @brief Serve doGet() of rarely changing routes from a cache, see PostgrestResponseCache.
+     * Only doGet(route) without options and without filter uses the cache. Writes through this
+     * client (and its PostgrestAsyncRequests) drop the cached results of the table they change;
+     * doPostRPC() can't tell which tables a function changes, call cache.invalidate() for them.
+     *
+     * @param cache response cache shared by all requests of this client, nullptr for none
+     */
+    void setResponseCache(PostgrestResponseCache *cache)
+    {
+        _cache = cache;
+    }
+
+    /**
+     * @brief Close a connection kept open by keep-alive mode, for example before the
+     * microcontroller goes to deep sleep or switches off WiFi.
+     */
+    void closeConnection()
+    {
+        _client.stop();
+        _connectedHost = nullptr;
+    }
+
+    /**
+     * @brief HTTP status code of the last response (data API or auth)
+     *
+     * @return int status code, 0 if no response was received (connection failure or timeout)
+     */
+    int getLastStatusCode() const
+    {
+        return _statusCode;
+    }
+
+    /**
+     * @brief Repeat failed requests (data API and auth) before returning an error, with growing
+     * delays in between, see PostgrestRetryPolicy. Without a policy nothing is retried.
+     * Requests that may have reached the server are only repeated if running them twice does no
+     * harm: GET, HEAD, PUT, DELETE, upserts (doUpsert()) and requests with an idempotencyKey in
+     * their options. Other POST and PATCH requests are only repeated if no connection could be
+     * made. The policy must stay valid while it is set.
+     *
+     * @param policy retry settings, nullptr to not retry
+     */
+    void setRetryPolicy(const PostgrestRetryPolicy *policy)
+    {
+        _retryPolicy = policy;
+    }
+
+    // seconds the server asked to wait before the next request (Retry-After of the last response), 0 if none
+    unsigned long getRetryAfter() const
+    {
+        return _retryAfter;
+    }
+
+    /**
+     * @brief true if the last failed request may succeed when it is repeated later:
+     * no response (connection failure, timeout), server error, 401 (the token is renewed before
+     * the next request), 408 or 429.
+     * false if the request was rejected (any other 4xx status) and repeating it won't help.
+     */
+    bool lastErrorIsTransient() const
+    {
+        return !(_statusCode >= 400 && _statusCode < 500 && _statusCode != 401 && _statusCode != 408 && _statusCode != 429);
+    }
+
+    /**
+     * @brief Renew the token ahead of its expiry while the application is idle, so that data
+     * requests never have to sign in first. Call regularly from loop(), preferably at a point
+     * where a short delay does not matter (e.g. right after a batch was sent).
+     * The token is renewed once it expires within the refresh margin (see setTokenRefresh()).
+     * After a failed renewal the next attempt is made 30 seconds later.
+     *
+     * @return const char* nullptr if the token is still valid or was renewed, error message
+     * if the renewal failed
+     */
+    const char *poll()
+    {
+        if (!_isSignedIn || !tokenRefreshDue(_refreshMargin + _refreshJitterOffset))
+            return nullptr;
+        if (_refreshFailed && millis() - _refreshFailedAt < 30000UL)
+            return nullptr;
+        const char *error = renewToken();
+        if (error)
+        {
+            _refreshFailed = true;
+            _refreshFailedAt = millis();
+        }
+        return error;
+    }
+
+    /**
+     * @brief Configure when poll() renews the token.
+     * A random jitter is added per token so that many devices signed in at the same time
+     * don't renew at the same moment. The margin should be larger than 60 seconds: within
+     * 60 seconds of expiry the next data request renews the token itself.
+     *
+     * @param margin seconds before expiry at which poll() renews the token (capped at half the token lifetime)
+     * @param jitter up to this many seconds are added to the margin
+     */
+    void setTokenRefresh(uint32_t margin, uint32_t jitter = 0)
+    {
+        _refreshMargin = margin;
+        _refreshJitter = jitter;
+        _refreshJitterOffset = jitter ? (uint32_t)random((long)jitter + 1) : 0;
+    }
+
+protected:
+    // base constructor: only subclasses should create concrete clients
+    PostgrestClient(WiFiClient &client) : _client(client), _authHost(nullptr), _authPath(nullptr), _apiHost(nullptr), _port(443), _apiPath(nullptr), _email(nullptr), _password(nullptr), _isSignedIn(false), _tokenExpiry(0), _internalTimeIat(0), _jwt(MAX_JWT_LENGTH - 1),
+                                          _refreshMargin(300), _refreshJitter(60), _refreshJitterOffset(0), _refreshFailed(false), _refreshFailedAt(0),
+                                          _keepAlive(false), _keepAliveIdleTimeout(30000), _dns(nullptr), _tlsSessions(nullptr), _tlsResumed(false), _connectedHost(nullptr), _lastActivity(0), _serverIdleTimeout(0),
+                                          _statusCode(0), _contentLength(-1), _chunked(false), _connectionClose(false), _gzip(false),
+                                          _contentRangeFirst(-1), _contentRangeLast(-1), _contentRangeTotal(-1), _retryAfter(0), _compression(false),
+                                          _out(client), _headerBlock(nullptr), _headerBlockLength(0), _rangeFirst(-1), _rangeLast(-1), _options(nullptr), _onConflict(nullptr), _csv(nullptr),
+                                          _rowsOpen(false), _rowsDone(false), _rowsSingle(false), _rowsRead(0), _rowsError(nullptr), _retryPolicy(nullptr), _cache(nullptr),
+                                          _requestArena(nullptr)
+    {
+        request.clear();
+        response.clear();
+        _status[0] = '\0';
+#if POSTGREST_METRICS
+        _metrics = PostgrestRequestMetrics();
+        _metricsTotals = PostgrestMetricsTotals();
+        _metricsCallback = nullptr;
+        _metricsContext = nullptr;
+        _metricsStart = 0;
+        _metricsBodyStart = 0;
+        _metricsOpen = false;
+        _tokenRefreshed = false;
+#endif
     }
 
     // Validate current JWT expiry and re-signin if necessary.
     // Returns nullptr on success, or an error message on failure.
+    // Last resort on the request path: poll() normally renews the token well before this.
     virtual const char *refreshTokenIfNeeded()
     {
         if (!_isSignedIn)
             return ERROR_NOT_SIGNED_IN;
 
-        if (_tokenExpiry == 0)
+        if (tokenRefreshDue(60U))
         {
-            if (!_email || !_password)
-                return "no credentials to refresh token";
-            return signIn(_email, _password);
+            const char *error = renewToken();
+#if POSTGREST_METRICS
+            _tokenRefreshed = !error; // reported with the data request that follows
+#endif
+            return error;
         }
 
-        unsigned long elapsed_ms = 0;
-        if (millis() >= _internalTimeIat)
-            elapsed_ms = millis() - _internalTimeIat;
-        else
-            elapsed_ms = 0;
+        return nullptr;
+    }
+
+    /**
+     * @brief true if the token expires within margin seconds (at most half its lifetime,
+     * so short-lived tokens are not renewed continuously) or its lifetime is unknown
+     */
+    bool tokenRefreshDue(uint32_t margin) const
+    {
+        if (_tokenExpiry == 0)
+            return true;
+        if (margin > _tokenExpiry / 2U)
+            margin = _tokenExpiry / 2U;
+        uint32_t elapsed = ((uint32_t)millis() - _internalTimeIat) / 1000U;
+        return elapsed + margin >= _tokenExpiry;
+    }
 
-        if (elapsed_ms / 1000U + 60U >= _tokenExpiry)
+    // status of a data API response: after a 401 the server no longer accepts the token
+    // (revoked, clock skew), so it is renewed before the next request
+    void checkTokenRejected(int statusCode)
+    {
+        if (statusCode == 401)
+            _tokenExpiry = 0;
+    }
+
+    /**
+     * @brief Hook for a vendor-specific token renewal that does not send the password again
+     * (e.g. Neon session cookie, Supabase refresh token).
+     * @return const char* nullptr if a new token was stored with tokenUpdated(), error message otherwise
+     */
+    virtual const char *renewSession()
+    {
+        return "token renewal not supported";
+    }
+
+    /**
+     * @brief Get a new token for the signed in user: the vendor's renewSession() first,
+     * a full sign-in with email and password only if that fails.
+     * A payload already prepared in getJsonRequest() is kept.
+     */
+    const char *renewToken()
+    {
+        JsonDocument pending(std::move(request));
+        if (_requestArena)
+            request = JsonDocument(_requestArena); // the move left request on the heap allocator
+        const char *error = renewSession();
+        if (error)
         {
-            if (!_email || !_password)
-                return "no credentials to refresh token";
-            return signIn(_email, _password);
+            if (_email && _password)
+                error = signIn(_email, _password);
+            else
+                error = "no credentials to refresh token";
         }
+        request = std::move(pending);
+        return error;
+    }
 
-        return nullptr;
+    /**
+     * @brief Store the lifetime of a new token in _jwt and mark the client as signed in.
+     * Must be called whenever the token changes, so the data API headers are rebuilt.
+     *
+     * @param lifetime token lifetime in seconds
+     */
+    void tokenUpdated(uint32_t lifetime)
+    {
+        _tokenExpiry = lifetime;
+        _internalTimeIat = millis();
+        _isSignedIn = true;
+        _refreshJitterOffset = _refreshJitter ? (uint32_t)random((long)_refreshJitter + 1) : 0;
+        _refreshFailed = false;
+        free(_headerBlock);
+        _headerBlock = nullptr;
     }
 
     /**
      * @brief common helper to send requests to the data API
-     * Hook for vendor-specific headers (e.g. Supabase needs `apikey:`)
+     * Hook for vendor-specific headers (e.g. Supabase needs `apikey:`).
+     * The headers are printed once into the prebuilt header block (see buildHeaderBlock()),
+     * so they must only depend on the vendor configuration and the token.
+     * @param out where the headers are printed to, each terminated by "\r\n"
      */
-    virtual void addVendorSpecificHeaders()
+    virtual void addVendorSpecificHeaders(Print &out)
     {
+        (void)out;
         // default: no vendor specific headers
     }
 
     /**
-     * @brief common helper to read responses in the data API
-     * Hook for vendor-specific respones (e.g. Supabase sends an additional line
-     * with the length of the json payload
+     * @brief common helper to send requests to the auth service
+     * Hook for vendor-specific auth headers (e.g. Neon needs `Origin:`, Supabase needs `apikey:`)
+     * @param out where the headers are printed to, each terminated by "\r\n"
+     * @param pathSuffix the auth endpoint the request is sent to, like "/sign-in/email"
      */
-    virtual void readVendorSpecificResponse()
+    virtual void addAuthHeaders(Print &out, const char *pathSuffix)
     {
+        (void)out;
+        (void)pathSuffix;
         // default: no vendor specific headers
     }
 
     /**
-     * @brief Connect to specified host.
+     * @brief common helper to read responses of the auth service
+     * Hook for vendor-specific response headers (e.g. Neon returns the session cookie and the JWT
+     * in headers). Called with the lowercased name of every header the base class does not handle.
+     * @param name header name
+     * @return true if the value was consumed with readHeaderValue() or skipHeaderValue()
+     * @return false to let the base class skip the value
+     */
+    virtual bool readVendorSpecificHeader(const char *name)
+    {
+        (void)name;
+        return false;
+    }
+
+    /**
+     * @brief Connect to specified host, by its cached address if setDnsCache() was called.
      * Can be overridden by subclass to use another port.
      * @param host the host to connect to
      *
@@ -297,90 +1246,1041 @@ protected:
      */
     virtual bool connectToHost(const char *host)
     {
+        if (_dns)
+            return _dns->connect(_client, host, _port);
         return _client.connect(host, _port);
     }
 
-    const char *invokeDataAPI(const char *verb, const char *pathSuffix, unsigned long timeout = 20000, bool expectJsonResult = false)
+    /**
+     * @brief Open a connection to host, or reuse the open one in keep-alive mode.
+     * An open connection is only reused if it goes to the same host, was not idle for too long,
+     * is still connected and has no unexpected data pending (e.g. a late error response).
+     *
+     * @param host the host to connect to
+     * @param reused set to true if an already open connection is reused
+     * @return true connection available
+     * @return false connection failed
+     */
+    bool openConnection(const char *host, bool *reused = nullptr)
     {
-        if (!connectToHost(_apiHost))
+        if (reused)
+            *reused = false;
+        if (_connectedHost)
         {
-            return "cannot connect to data api host over Wifi";
+            unsigned long idleTimeout = _keepAliveIdleTimeout;
+            if (_serverIdleTimeout && _serverIdleTimeout < idleTimeout)
+                idleTimeout = _serverIdleTimeout;
+            bool sameHost = _connectedHost == host || strcmp(_connectedHost, host) == 0;
+            if (_keepAlive && sameHost && millis() - _lastActivity < idleTimeout && _client.connected() && !_client.available())
+            {
+                if (reused)
+                    *reused = true;
+                return true;
+            }
+            closeConnection();
         }
+        if (_tlsSessions)
+            _tlsSessions->offer(host);
+        if (!connectToHost(host))
+            return false;
+        _tlsResumed = _tlsSessions && _tlsSessions->resumed(host);
+        _connectedHost = host;
+        _serverIdleTimeout = 0;
+        _lastActivity = millis();
+        return true;
+    }
 
-        _client.print(verb);
-        _client.print(" ");
-        _client.print(_apiPath);
-        _client.print(pathSuffix);
-        _client.println(" HTTP/1.1");
-        _client.print("Host: ");
-        _client.println(_apiHost);
-        _client.println("Content-Type: application/json");
-        _client.print("Authorization: Bearer ");
-        _client.println(_jwtBuffer);
-        // allow vendor subclasses to add additional headers (e.g. Supabase api key)
-        addVendorSpecificHeaders();
+    /**
+     * @brief Keep the connection open for the next request if keep-alive mode is enabled,
+     * the server allows it and the response body was consumed completely. Close it otherwise.
+     */
+    void releaseConnection(bool bodyConsumed)
+    {
+        if (_keepAlive && bodyConsumed && !_connectionClose && _connectedHost)
+            _lastActivity = millis();
+        else
+            closeConnection();
+    }
 
-        if (strncmp(verb, "GET", 3) != 0)
-        {
-            _client.print("Content-Length: ");
-            size_t length = measureJson(request);
-            _client.print(length);
-            _client.print("\r\n\r\n");
+    // read one byte of the response head, -1 on timeout
+    int readResponseByte()
+    {
+        char c;
+        if (_client.readBytes(&c, 1) != 1)
+            return -1;
+#if POSTGREST_METRICS
+        _metrics.bytesReceived++;
+#endif
+        return (unsigned char)c;
+    }
 
-            size_t written = serializeJson(request, _client);
-            if (written != length)
+    /**
+     * @brief Read the name of the next response header, lowercased and truncated to cap - 1.
+     * The value must then be consumed with readHeaderValue() or skipHeaderValue().
+     *
+     * @return int 1 if a header name was read, 0 at the empty line that ends the headers, -1 on timeout
+     */
+    int readHeaderName(char *name, size_t cap)
+    {
+        while (true)
+        {
+            size_t len = 0;
+            int c = readResponseByte();
+            if (c == '\r')
+                c = readResponseByte();
+            if (c == '\n')
+                return 0;
+            while (c >= 0 && c != ':' && c != '\n')
             {
-                _client.stop();
-                return "payload serialization error";
+                if (len + 1 < cap)
+                    name[len++] = (char)tolower(c);
+                c = readResponseByte();
             }
+            name[len] = '\0';
+            if (c == ':')
+                return 1;
+            if (c < 0)
+                return -1;
+            // line without ':' - ignore it
         }
-        else
+    }
+
+    /**
+     * @brief Read the value of the current response header without surrounding whitespace,
+     * truncated to cap - 1 characters.
+     *
+     * @return true value read up to the end of the line
+     * @return false timeout
+     */
+    bool readHeaderValue(char *value, size_t cap)
+    {
+        return readHeaderPart(value, cap, '\n') >= 0;
+    }
+
+    /**
+     * @brief Read the current response header value up to the stop character or the end of
+     * the line, without surrounding whitespace and truncated to cap - 1 characters.
+     * The rest of the line is left unread if stop was found.
+     *
+     * @return int the character that ended the part (stop or '\n'), -1 on timeout
+     */
+    int readHeaderPart(char *value, size_t cap, char stop)
+    {
+        size_t len = 0;
+        int c = readResponseByte();
+        while (c == ' ' || c == '\t')
+            c = readResponseByte();
+        while (c >= 0 && c != '\n' && c != stop)
         {
-            _client.print("\r\n");
+            if (len + 1 < cap)
+                value[len++] = (char)c;
+            c = readResponseByte();
         }
-        _client.flush();
+        while (len > 0 && (value[len - 1] == '\r' || value[len - 1] == ' ' || value[len - 1] == '\t'))
+            len--;
+        value[len] = '\0';
+        return c;
+    }
+
+    /**
+     * @brief Like readHeaderPart() but into a credential that grows to the length of the value.
+     * Check value.truncated() for values longer than the credential allows.
+     */
+    int readHeaderPart(PostgrestCredential &value, char stop)
+    {
+        value.begin();
+        int c = readResponseByte();
+        while (c == ' ' || c == '\t')
+            c = readResponseByte();
+        while (c >= 0 && c != '\n' && c != stop)
+        {
+            if (c != '\r')
+                value.append((char)c);
+            c = readResponseByte();
+        }
+        value.shrink();
+        return c;
+    }
+
+    bool skipHeaderValue()
+    {
+        int c;
+        do
+        {
+            c = readResponseByte();
+        } while (c >= 0 && c != '\n');
+        return c >= 0;
+    }
+
+    /**
+     * @brief Wait for the response, then read its status line into _status and its headers.
+     * Sets _statusCode and the body framing (_contentLength, _chunked, _connectionClose).
+     *
+     * @param timeout milliseconds to wait for the first response byte
+     * @param authResponse true to pass unknown headers to readVendorSpecificHeader()
+     * @return const char* nullptr if a complete response head was read (with any status code),
+     * error message otherwise
+     */
+    const char *readResponseHead(unsigned long timeout, bool authResponse = false)
+    {
+        _statusCode = 0;
+        _contentLength = -1;
+        _chunked = false;
+        _connectionClose = false;
+        _gzip = false;
+        _contentRangeFirst = -1;
+        _contentRangeLast = -1;
+        _contentRangeTotal = -1;
+        _retryAfter = 0;
 
         unsigned long ms = millis();
         while (!_client.available() && millis() - ms < timeout)
         {
+            if (!_client.connected())
+                break;
             delay(0);
         }
 
         if (!_client.available())
         {
-            _client.stop();
             return "request timed out";
         }
+        markMetrics(&PostgrestRequestMetrics::firstByte);
 
         size_t bytes_read = _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
         _status[bytes_read] = 0;
+#if POSTGREST_METRICS
+        _metrics.bytesReceived += bytes_read + 1;
+#endif
         int status_code = 0;
         if (bytes_read >= 12)
             sscanf(_status + 9, "%3d", &status_code);
-        if (status_code < 200 || status_code >= 300)
+        if (status_code == 0)
+            return _status;
+        if (bytes_read == sizeof(_status) - 1)
+            skipHeaderValue(); // overlong reason phrase
+
+        char name[24];
+        char value[48];
+        int more;
+        while ((more = readHeaderName(name, sizeof(name))) > 0)
+        {
+            if (strcmp(name, "content-length") == 0)
+            {
+                readHeaderValue(value, sizeof(value));
+                _contentLength = strtol(value, nullptr, 10);
+            }
+            else if (strcmp(name, "transfer-encoding") == 0)
+            {
+                readHeaderValue(value, sizeof(value));
+                _chunked = strstr(value, "chunked") != nullptr;
+            }
+            else if (strcmp(name, "connection") == 0)
+            {
+                readHeaderValue(value, sizeof(value));
+                _connectionClose = strstr(value, "close") != nullptr || strstr(value, "Close") != nullptr;
+            }
+            else if (strcmp(name, "keep-alive") == 0)
+            {
+                readHeaderValue(value, sizeof(value));
+                const char *t = strstr(value, "timeout=");
+                long seconds = t ? strtol(t + 8, nullptr, 10) : 0;
+                // stay a second below the server's limit to not race its close
+                if (seconds > 1)
+                    _serverIdleTimeout = (unsigned long)(seconds - 1) * 1000UL;
+            }
+            else if (strcmp(name, "content-encoding") == 0)
+            {
+                readHeaderValue(value, sizeof(value));
+                _gzip = strstr(value, "gzip") != nullptr;
+            }
+            else if (strcmp(name, "content-range") == 0)
+            {
+                // "0-24/3573", "*/3573" (no rows) or "0-24/*" (not counted)
+                readHeaderValue(value, sizeof(value));
+                char *p = value;
+                if (isdigit((unsigned char)*p))
+                {
+                    _contentRangeFirst = strtol(p, &p, 10);
+                    if (*p == '-')
+                        _contentRangeLast = strtol(p + 1, &p, 10);
+                }
+                p = strchr(p, '/');
+                if (p && isdigit((unsigned char)p[1]))
+                    _contentRangeTotal = strtol(p + 1, nullptr, 10);
+            }
+            else if (strcmp(name, "retry-after") == 0)
+            {
+                // delay in seconds; an HTTP date can't be compared without a clock and is ignored
+                readHeaderValue(value, sizeof(value));
+                unsigned long seconds = isdigit((unsigned char)value[0]) ? strtoul(value, nullptr, 10) : 0;
+                _retryAfter = seconds < 86400UL ? seconds : 86400UL;
+            }
+            else if (!authResponse || !readVendorSpecificHeader(name))
+            {
+                skipHeaderValue();
+            }
+        }
+        if (more < 0)
+            return "Invalid response";
+
+        // responses without body regardless of headers
+        if (status_code == 204 || status_code == 304 || (status_code >= 100 && status_code < 200))
+        {
+            _contentLength = 0;
+            _chunked = false;
+            _gzip = false;
+        }
+        _statusCode = status_code;
+        markMetrics(&PostgrestRequestMetrics::headers);
+        return nullptr;
+    }
+
+    /**
+     * @brief Skip the body of the current response
+     *
+     * @return true the body was consumed and the connection can be reused
+     * @return false the body framing does not allow to skip it
+     */
+    bool skipResponseBody()
+    {
+        if (!_chunked && _contentLength < 0)
+            return false;
+        openResponseBody();
+        return _body.drain();
+    }
+
+    // data API headers that only change with the token: Host, Authorization and vendor headers
+    void printStaticHeaders(Print &out)
+    {
+        out.print("Host: ");
+        out.println(_apiHost);
+        out.print("Authorization: Bearer ");
+        out.println(_jwt.c_str());
+        // allow vendor subclasses to add additional headers (e.g. Supabase api key)
+        addVendorSpecificHeaders(out);
+    }
+
+    /**
+     * @brief Preformat the static data API headers into _headerBlock, sized to fit.
+     * The block is freed by tokenUpdated() and rebuilt with the next request.
+     * If it cannot be allocated the headers are formatted for every request instead.
+     */
+    void buildHeaderBlock()
+    {
+        PostgrestCharPrint measure(nullptr, 0);
+        printStaticHeaders(measure);
+        _headerBlockLength = measure.length();
+        _headerBlock = (char *)malloc(_headerBlockLength + 1);
+        if (!_headerBlock)
+            return;
+        PostgrestCharPrint block(_headerBlock, _headerBlockLength + 1);
+        printStaticHeaders(block);
+    }
+
+    // send request line, headers and payload (rawBody if given, getJsonRequest() otherwise)
+    const char *sendDataRequest(const char *verb, const char *pathSuffix, const char *rawBody, size_t rawLength)
+    {
+        _out.begin();
+        const char *error = writeDataRequest(verb, pathSuffix, rawBody, rawLength);
+        if (error)
+            return error;
+        _out.flush();
+        if (_out.failed())
+            return "connection lost while sending request";
+        return nullptr;
+    }
+
+    // write a data API request to _out without flushing it, see sendDataRequest()
+    const char *writeDataRequest(const char *verb, const char *pathSuffix, const char *rawBody, size_t rawLength)
+    {
+        if (!_headerBlock)
+            buildHeaderBlock();
+
+        _out.print(verb);
+        _out.print(" ");
+        _out.print(_apiPath);
+        _out.print(pathSuffix);
+        if (_onConflict)
+        {
+            _out.print(strchr(pathSuffix, '?') ? "&on_conflict=" : "?on_conflict=");
+            _out.print(_onConflict);
+        }
+        _out.println(" HTTP/1.1");
+        if (_headerBlock)
+            _out.write((const uint8_t *)_headerBlock, _headerBlockLength);
+        else
+            printStaticHeaders(_out);
+        if (_rangeFirst >= 0)
+        {
+            _out.print("Range-Unit: items\r\nRange: ");
+            _out.print(_rangeFirst);
+            _out.print('-');
+            _out.print(_rangeLast);
+            _out.print("\r\n");
+        }
+        printPreferHeader(_out);
+        if (_options && _options->idempotencyKey)
+        {
+            _out.print("Idempotency-Key: ");
+            _out.print(_options->idempotencyKey);
+            _out.print("\r\n");
+        }
+        if (_compression)
+            _out.print("Accept-Encoding: gzip\r\n");
+
+        if (_csv && strcmp(verb, "POST") == 0)
+        {
+            const char *error = sendCsvBody();
+            if (error)
+                return error;
+        }
+        else if (strcmp(verb, "GET") != 0 && strcmp(verb, "HEAD") != 0)
+        {
+            _out.println("Content-Type: application/json");
+            _out.print("Content-Length: ");
+            size_t length = rawBody ? rawLength : measureJson(request);
+            _out.print(length);
+            _out.print("\r\n\r\n");
+
+            size_t written = rawBody ? _out.write((const uint8_t *)rawBody, rawLength) : serializeJson(request, _out);
+            if (written != length && !_out.failed())
+            {
+                return "payload serialization error";
+            }
+        }
+        else
+        {
+            _out.print("\r\n");
+        }
+        return nullptr;
+    }
+
+    // header line and all rows of the CSV body
+    size_t printCsv(Print &out)
+    {
+        PostgrestCsvWriter csv(out);
+        csv.header(_csv->columns);
+        for (size_t row = 0; _csv->callback(csv, row, _csv->context); row++)
+            csv.endRow();
+        return csv.length();
+    }
+
+    // Content-Type, framing headers and the CSV body of doPostCsv()
+    const char *sendCsvBody()
+    {
+        _out.println("Content-Type: text/csv");
+        if (_csv->chunked)
+        {
+            _out.print("Transfer-Encoding: chunked\r\n\r\n");
+            PostgrestChunkedPrint<256> chunks(_out);
+            printCsv(chunks);
+            chunks.finish();
+            return nullptr;
+        }
+        PostgrestCharPrint measure(nullptr, 0);
+        size_t length = printCsv(measure);
+        _out.print("Content-Length: ");
+        _out.print(length);
+        _out.print("\r\n\r\n");
+        if (printCsv(_out) != length && !_out.failed())
+            return "CSV rows changed while sending";
+        return nullptr;
+    }
+
+    // send request line, headers and payload from getJsonRequest() (unless GET) to the auth service
+    const char *sendAuthRequest(const char *verb, const char *pathSuffix)
+    {
+        _out.begin();
+        _out.print(verb);
+        _out.print(" ");
+        _out.print(_authPath);
+        _out.print(pathSuffix);
+        _out.println(" HTTP/1.1");
+        _out.print("Host: ");
+        _out.println(_authHost);
+        _out.println("Accept: application/json");
+        // allow vendor subclasses to add additional headers (e.g. Neon origin and session cookie)
+        addAuthHeaders(_out, pathSuffix);
+
+        if (strncmp(verb, "GET", 3) != 0)
+        {
+            _out.println("Content-Type: application/json");
+            _out.print("Content-Length: ");
+            size_t length = measureJson(request);
+            _out.print(length);
+            _out.print("\r\n\r\n");
+
+            size_t written = serializeJson(request, _out);
+            if (written != length && !_out.failed())
+            {
+                return "payload serialization error";
+            }
+        }
+        else
+        {
+            _out.print("\r\n");
+        }
+        _out.flush();
+        if (_out.failed())
+            return "connection lost while sending request";
+        return nullptr;
+    }
+
+    /**
+     * @brief Send a data API request and read the response head.
+     * On success the response body is ready to be read with openResponseBody().
+     *
+     * @return const char* nullptr for a 2xx response, error message otherwise
+     */
+    const char *requestDataAPI(const char *verb, const char *pathSuffix, unsigned long timeout, const char *rawBody, size_t rawLength)
+    {
+        const char *error = performRequest(false, verb, pathSuffix, timeout, rawBody, rawLength);
+        _options = nullptr; // options, on_conflict and CSV body apply to one request
+        _onConflict = nullptr;
+        _csv = nullptr;
+        return error;
+    }
+
+    /**
+     * @brief Send an auth service request with payload from getJsonRequest() and read the response head.
+     * Response headers not handled by the base class are passed to readVendorSpecificHeader().
+     * On success the response body is ready to be read with openResponseBody().
+     *
+     * @return const char* nullptr for a 2xx response, error message otherwise
+     */
+    const char *requestAuthAPI(const char *verb, const char *pathSuffix, unsigned long timeout)
+    {
+        return performRequest(true, verb, pathSuffix, timeout, nullptr, 0);
+    }
+
+    /**
+     * @brief Run up to POSTGREST_PIPELINE_DEPTH queries of doGetPipelined() in rounds until each
+     * got a response or failed for good
+     *
+     * @param pending indices of the queries in gets, reordered here
+     * @param started millis() when doGetPipelined() started, for the retry deadline
+     * @param retries retries so far for each kind of failure, shared by all queries
+     * @param opened true once a round was sent, so that later rounds continue on its connection
+     */
+    void pipelineGets(PostgrestPipelinedGet *gets, size_t *pending, size_t waiting, unsigned long timeout, unsigned long started,
+                      uint8_t *retries, bool &opened)
+    {
+        bool staleRetried = false;
+        while (waiting > 0)
+        {
+            bool reused = opened && _connectedHost; // the previous round left the connection open
+            opened = true;
+            size_t answered;
+            PostgrestRetryPolicy::Failure failure;
+            const char *error = pipelineRound(gets, pending, waiting, answered, attemptTimeout(timeout, started), reused, failure);
+
+            uint32_t wait = 0;
+            bool serverErrors = false;
+            for (size_t i = 0; i < answered; i++)
+                serverErrors = serverErrors || isServerError(gets[pending[i]].statusCode);
+            bool retryServer = serverErrors && retryDue(PostgrestRetryPolicy::SERVER_ERROR, false, "GET", started, retries, wait);
+            if (error)
+            {
+                closeConnection();
+                // closed after some responses: send the rest again. At once if it failed on a
+                // kept-alive connection (closed while idle), but only once; otherwise as set by
+                // the retry policy.
+                bool stale = answered == 0 && reused && !staleRetried && _statusCode == 0;
+                staleRetried = staleRetried || stale;
+                if (answered == 0 && !stale && !retryDue(failure, false, "GET", started, retries, wait))
+                {
+                    for (size_t i = 0; i < waiting; i++)
+                    {
+                        gets[pending[i]].error = error;
+                        gets[pending[i]].statusCode = 0;
+                    }
+                    return;
+                }
+            }
+
+            // keep the unanswered queries and, if they are retried, those with a server error
+            size_t kept = 0;
+            for (size_t i = 0; i < waiting; i++)
+            {
+                if (i >= answered || (retryServer && isServerError(gets[pending[i]].statusCode)))
+                    pending[kept++] = pending[i];
+            }
+            waiting = kept;
+            if (waiting)
+            {
+                markRetry();
+                if (wait)
+                    delay(wait);
+            }
+        }
+    }
+
+    /**
+     * @brief One round of doGetPipelined(): send the pending queries back to back on one
+     * connection and read their responses
+     *
+     * @param pending indices of the queries in gets, at most POSTGREST_PIPELINE_DEPTH
+     * @param answered set to the number of pending queries, from the first, that got a response
+     * @param reused true to continue on the open connection; otherwise set if openConnection()
+     * reused a kept-alive connection
+     * @param failure set to the kind of failure if not all queries got a response
+     * @return const char* nullptr if all queries of the round got a response,
+     * otherwise why the queries from answered on got none
+     */
+    const char *pipelineRound(PostgrestPipelinedGet *gets, const size_t *pending, size_t count, size_t &answered, unsigned long timeout,
+                              bool &reused, PostgrestRetryPolicy::Failure &failure)
+    {
+        answered = 0;
+        _statusCode = 0;
+        failure = PostgrestRetryPolicy::CONNECT_FAILED;
+        if (!reused && !openConnection(_apiHost, &reused))
+            return "cannot connect to data api host over Wifi";
+        markConnected(reused);
+        failure = PostgrestRetryPolicy::NO_RESPONSE;
+        _out.begin();
+        for (size_t i = 0; i < count; i++)
+            writeDataRequest("GET", gets[pending[i]].route, nullptr, 0);
+        _out.flush();
+        if (_out.failed())
+            return "connection lost while sending request";
+        markMetrics(&PostgrestRequestMetrics::sent);
+
+        const char *error = nullptr;
+        unsigned long retryAfter = 0; // longest Retry-After of the round
+        while (!error && answered < count)
+        {
+            error = readResponseHead(timeout);
+            if (error)
+                break;
+            PostgrestPipelinedGet &get = gets[pending[answered++]];
+            get.statusCode = _statusCode;
+            get.error = nullptr;
+            bool consumed;
+            if (_statusCode < 200 || _statusCode >= 300)
+            {
+                get.error = "HTTP error status (see statusCode)"; // _status is overwritten by the next response
+                checkTokenRejected(_statusCode);
+                if (isServerError(_statusCode) && _retryAfter > retryAfter)
+                    retryAfter = _retryAfter;
+                consumed = skipResponseBody();
+            }
+            else
+            {
+                Stream &body = openResponseBody();
+                if (get.result)
+                {
+                    DeserializationError err = deserializeJson(*get.result, body);
+                    if (err)
+                        get.error = jsonError(err);
+                }
+                consumed = _body.drain();
+            }
+            // the rest of the pipeline needs the next response on this connection
+            if (!consumed || _connectionClose)
+            {
+                closeConnection();
+                if (answered < count)
+                    error = "connection closed by server";
+                break;
+            }
+        }
+        _retryAfter = retryAfter;
+        return error;
+    }
+
+    // common part of requestDataAPI() and requestAuthAPI(): attempts the request as allowed by setRetryPolicy()
+    const char *performRequest(bool auth, const char *verb, const char *pathSuffix, unsigned long timeout, const char *rawBody, size_t rawLength)
+    {
+        beginMetrics(auth, verb, pathSuffix);
+        if (!rawBody && request.overflowed())
+        {
+            // a member of the payload could not be stored: don't send an incomplete request
+            _statusCode = 0;
+            return endMetrics("request payload exceeds JSON memory");
+        }
+        unsigned long started = millis();
+        uint8_t retries[PostgrestRetryPolicy::NOT_RETRYABLE] = {};
+        while (true)
+        {
+            PostgrestRetryPolicy::Failure failure;
+            const char *error = attemptRequest(auth, verb, pathSuffix, attemptTimeout(timeout, started), rawBody, rawLength, failure);
+            if (!error)
+                return nullptr;
+            uint32_t wait;
+            if (!retryDue(failure, auth, verb, started, retries, wait))
+                return endMetrics(error);
+            markRetry();
+            delay(wait);
+        }
+    }
+
+    /**
+     * @brief Send the request and read the response head. If a kept-alive connection turns out
+     * to be closed by the server, the request is sent once more on a new connection right away.
+     *
+     * @param failure set to the kind of failure if the attempt failed
+     * @return const char* nullptr for a 2xx response, error message otherwise
+     */
+    const char *attemptRequest(bool auth, const char *verb, const char *pathSuffix, unsigned long timeout, const char *rawBody, size_t rawLength,
+                               PostgrestRetryPolicy::Failure &failure)
+    {
+        for (int attempt = 0;; attempt++)
+        {
+            bool reused = false;
+            if (!openConnection(auth ? _authHost : _apiHost, &reused))
+            {
+                _statusCode = 0;
+                failure = PostgrestRetryPolicy::CONNECT_FAILED;
+                return auth ? "cannot connect to auth host over Wifi" : "cannot connect to data api host over Wifi";
+            }
+            markConnected(reused);
+
+            failure = PostgrestRetryPolicy::NO_RESPONSE;
+            const char *error = auth ? sendAuthRequest(verb, pathSuffix) : sendDataRequest(verb, pathSuffix, rawBody, rawLength);
+            if (!error)
+            {
+                markMetrics(&PostgrestRequestMetrics::sent);
+                error = readResponseHead(timeout, auth);
+            }
+            else if (!_out.failed())
+            {
+                failure = PostgrestRetryPolicy::NOT_RETRYABLE; // the payload could not be written
+            }
+            if (!error && strcmp(verb, "HEAD") == 0)
+            {
+                // headers describe the body a GET would get, but none follows
+                _contentLength = 0;
+                _chunked = false;
+                _gzip = false;
+            }
+            if (error)
+            {
+                // the server may close a kept-alive connection at any time; if that happened
+                // before any response byte arrived, repeat the request once on a new connection
+                bool stale = reused && attempt == 0 && _statusCode == 0 && !_client.connected();
+                closeConnection();
+                if (stale)
+                {
+                    markRetry();
+                    continue;
+                }
+                return error;
+            }
+            break;
+        }
+
+        if (_statusCode < 200 || _statusCode >= 300)
+        {
+            releaseConnection(skipResponseBody());
+            if (!auth)
+                checkTokenRejected(_statusCode);
+            failure = isServerError(_statusCode) ? PostgrestRetryPolicy::SERVER_ERROR : PostgrestRetryPolicy::NOT_RETRYABLE;
+            return _status;
+        }
+        return nullptr;
+    }
+
+    // status of a response the server may answer differently later: 5xx, 408 or 429
+    static bool isServerError(int statusCode)
+    {
+        return statusCode >= 500 || statusCode == 408 || statusCode == 429;
+    }
+
+    // timeout of one attempt: at most what is left until the deadline of the retry policy
+    unsigned long attemptTimeout(unsigned long timeout, unsigned long started) const
+    {
+        if (!_retryPolicy || !_retryPolicy->deadline)
+            return timeout;
+        unsigned long elapsed = millis() - started;
+        unsigned long left = elapsed < _retryPolicy->deadline ? _retryPolicy->deadline - elapsed : 0;
+        return left < timeout ? left : timeout;
+    }
+
+    /**
+     * @brief Decide whether a failed request is repeated, see setRetryPolicy()
+     *
+     * @param started millis() when the first attempt started
+     * @param retries retries so far for each kind of failure, counted up here
+     * @param wait set to the milliseconds to wait before the next attempt
+     */
+    bool retryDue(PostgrestRetryPolicy::Failure failure, bool auth, const char *verb, unsigned long started, uint8_t *retries, uint32_t &wait)
+    {
+        if (!_retryPolicy || failure == PostgrestRetryPolicy::NOT_RETRYABLE)
+            return false;
+        // once connected, the server may have executed the request already
+        if (failure != PostgrestRetryPolicy::CONNECT_FAILED && !retrySafe(auth, verb))
+            return false;
+        const PostgrestRetryRule &rule = _retryPolicy->rule(failure);
+        if (retries[failure] >= rule.retries)
+            return false;
+        uint32_t retryAfter = failure == PostgrestRetryPolicy::SERVER_ERROR ? (uint32_t)_retryAfter * 1000UL : 0;
+        if (retryAfter > rule.maxDelay)
+            return false; // the server does not expect to be back soon enough
+        wait = PostgrestRetryPolicy::delay(rule, retries[failure], retryAfter);
+        if (_retryPolicy->deadline && millis() - started + wait >= _retryPolicy->deadline)
+            return false;
+        retries[failure]++;
+        return true;
+    }
+
+    // true if executing the request twice has the same effect as executing it once
+    bool retrySafe(bool auth, const char *verb) const
+    {
+        bool post = strcmp(verb, "POST") == 0;
+        if (!post && strcmp(verb, "PATCH") != 0)
+            return true; // GET, HEAD, PUT, DELETE
+        if (auth || !_options)
+            return false; // e.g. a used refresh token must not be sent again
+        return _options->idempotencyKey || (post && _options->resolution);
+    }
+
+    /**
+     * @brief Start the metrics of a request, see onRequestMetrics().
+     * Every request started here is completed by exactly one endMetrics(): in performRequest() if it
+     * fails, otherwise when its body was read (invokeDataAPI(), invokeAuthAPI(), endRows()).
+     */
+    void beginMetrics(bool auth, const char *verb, const char *path)
+    {
+#if POSTGREST_METRICS
+        _metrics = PostgrestRequestMetrics();
+        _metrics.verb = verb;
+        _metrics.path = path;
+        _metrics.auth = auth;
+        if (!auth)
+        {
+            _metrics.tokenRefreshed = _tokenRefreshed;
+            _tokenRefreshed = false;
+        }
+        _metricsStart = micros();
+        _metricsBodyStart = _body.received();
+        _metricsOpen = true;
+        _out.begin(); // sent() counts this request only, even if it fails before sending
+#else
+        (void)auth;
+        (void)verb;
+        (void)path;
+#endif
+    }
+
+    // record the time the request reached a phase
+    void markMetrics(uint32_t PostgrestRequestMetrics::*phase)
+    {
+#if POSTGREST_METRICS
+        if (_metricsOpen)
+            _metrics.*phase = (uint32_t)(micros() - _metricsStart);
+#else
+        (void)phase;
+#endif
+    }
+
+    void markConnected(bool reused)
+    {
+#if POSTGREST_METRICS
+        _metrics.reused = reused;
+        _metrics.tlsResumed = !reused && _tlsResumed;
+#else
+        (void)reused;
+#endif
+        markMetrics(&PostgrestRequestMetrics::connected);
+    }
+
+    // the request is repeated: the phases start over, the traffic adds up
+    void markRetry()
+    {
+#if POSTGREST_METRICS
+        _metrics.retries++;
+        _metrics.bytesSent += _out.sent();
+        _metrics.connected = 0;
+        _metrics.sent = 0;
+        _metrics.firstByte = 0;
+        _metrics.headers = 0;
+#endif
+    }
+
+    /**
+     * @brief Complete the metrics of the current request: update the totals and call the callback
+     *
+     * @return const char* error, to return it from the caller
+     */
+    const char *endMetrics(const char *error)
+    {
+#if POSTGREST_METRICS
+        if (!_metricsOpen)
+            return error;
+        _metricsOpen = false;
+        _metrics.done = (uint32_t)(micros() - _metricsStart);
+        _metrics.error = error;
+        _metrics.statusCode = _statusCode;
+        _metrics.bytesSent += _out.sent();
+        _metrics.bytesReceived += _body.received() - _metricsBodyStart;
+        _metricsTotals.add(_metrics);
+        if (_metricsCallback)
+            _metricsCallback(_metrics, _metricsContext);
+#endif
+        return error;
+    }
+
+    /**
+     * @brief Frame the body of the current response: decode chunked transfer encoding,
+     * otherwise by its Content-Length or up to the end of the connection.
+     * Chunked encoding takes precedence over Content-Length (RFC 9112, 6.3).
+     * A gzip encoded body is decompressed.
+     */
+    Stream &openResponseBody()
+    {
+        if (_chunked)
+            _body.beginChunked(_client);
+        else if (_contentLength >= 0)
+            _body.beginFixedLength(_client, (size_t)_contentLength);
+        else
+            _body.beginUntilClose(_client);
+        if (_gzip)
+            _inflate.begin(_body);
+        return responseStream();
+    }
+
+    // the decoded body opened by openResponseBody()
+    Stream &responseStream()
+    {
+        if (_gzip)
+            return _inflate;
+        return _body;
+    }
+
+    /**
+     * @brief Done with the response body: keep the connection for the next request if the rest
+     * of the body can be skipped, close it otherwise.
+     *
+     * @param skipRest false to close the connection without reading the rest of the body
+     */
+    void closeResponseBody(bool skipRest = true)
+    {
+        releaseConnection(skipRest && _body.drain());
+    }
+
+    /**
+     * @brief Send a data API request and parse its JSON response into getJsonResult() if expected.
+     * A non-null filter drops unselected fields while parsing.
+     */
+    const char *invokeDataAPI(const char *verb, const char *pathSuffix, unsigned long timeout = 20000, bool expectJsonResult = false,
+                              const char *rawBody = nullptr, size_t rawLength = 0, JsonVariantConst filter = JsonVariantConst(),
+                              uint8_t nestingLimit = ARDUINOJSON_DEFAULT_NESTING_LIMIT)
+    {
+        const char *error = requestDataAPI(verb, pathSuffix, timeout, rawBody, rawLength);
+        if (error)
+            return error;
+        request.clear(); // sent: free its memory (or arena) for the response
+
+        Stream &body = openResponseBody();
+        DeserializationError err;
+        if (expectJsonResult && filter.isNull())
+            err = deserializeJson(response, body, DeserializationOption::NestingLimit(nestingLimit));
+        else if (expectJsonResult)
+            err = deserializeJson(response, body, DeserializationOption::Filter(filter), DeserializationOption::NestingLimit(nestingLimit));
+        closeResponseBody();
+        return endMetrics(err ? jsonError(err) : nullptr);
+    }
+
+    /**
+     * @brief Send a request to the auth service and parse its JSON response into getJsonResult()
+     *
+     * @param verb "POST" sends getJsonRequest() as payload, "GET" sends no payload
+     * @param pathSuffix auth endpoint like "/sign-in/email"
+     * @param timeout
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *invokeAuthAPI(const char *verb, const char *pathSuffix, unsigned long timeout)
+    {
+        const char *error = requestAuthAPI(verb, pathSuffix, timeout);
+        if (error)
+            return error;
+        request.clear();
+
+        DeserializationError err = deserializeJson(response, openResponseBody());
+        closeResponseBody();
+        return endMetrics(err ? jsonError(err) : nullptr);
+    }
+
+    // write request (doPost, doPatch, ...): parse the response only if options ask for the rows
+    const char *invokeWithOptions(const char *verb, const char *pathSuffix, unsigned long timeout, const PostgrestRequestOptions *options,
+                                  const char *rawBody = nullptr, size_t rawLength = 0)
+    {
+        if (_cache)
+            _cache->invalidate(pathSuffix); // even if it fails: the server may have applied it
+        bool rows = options && options->returnsRows();
+        if (rows)
+            response.clear();
+        _options = options;
+        return invokeDataAPI(verb, pathSuffix, timeout, rows, rawBody, rawLength);
+    }
+
+    // Prefer header for the options of the current request, nothing if there are none
+    void printPreferHeader(Print &out)
+    {
+        if (!_options)
+            return;
+        const char *separator = "Prefer: ";
+        if (_options->resolution)
+        {
+            out.print(separator);
+            out.print("resolution=");
+            out.print(_options->resolution);
+            separator = ", ";
+        }
+        if (_options->returnMode)
         {
-            _client.stop();
-            return _status;
+            out.print(separator);
+            out.print("return=");
+            out.print(_options->returnMode);
+            separator = ", ";
+        }
+        if (_options->count)
+        {
+            out.print(separator);
+            out.print("count=");
+            out.print(_options->count);
+            separator = ", ";
         }
+        if (_options->missingDefault)
+        {
+            out.print(separator);
+            out.print("missing=default");
+            separator = ", ";
+        }
+        if (separator[0] == ',')
+            out.print("\r\n");
+    }
+
+    // error message for a failed deserializeJson()
+    const char *jsonError(DeserializationError err) const
+    {
+        if (_gzip && _inflate.error())
+            return _inflate.error(); // the JSON error is only a consequence
+        if (err == DeserializationError::NoMemory)
+            return "response exceeds JSON memory";
+        return err.c_str();
+    }
 
-        if (expectJsonResult)
+    // next non-whitespace character of the row stream without consuming it, -1 at its end or on timeout
+    int peekRowStream()
+    {
+        unsigned long ms = millis();
+        while (true)
         {
-            char endOfHeaders[] = "\r\n\r\n";
-            if (!_client.find(endOfHeaders))
-            {
-                _client.stop();
-                return "Invalid response";
-            }
-            readVendorSpecificResponse();
-            DeserializationError err = deserializeJson(response, _client);
-            if (err)
+            int c = responseStream().peek();
+            if (c < 0)
             {
-                _client.stop();
-                return err.c_str();
+                if ((_gzip ? _inflate.finished() : _body.finished()) || millis() - ms >= _client.getTimeout())
+                    return -1;
+                delay(0);
+                continue;
             }
+            if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+                return c;
+            responseStream().read();
+            ms = millis();
         }
-        _client.stop();
-        return nullptr;
     }
 
 protected:
@@ -397,9 +2297,73 @@ protected:
     char _status[64];
     uint32_t _tokenExpiry;     // token lifetime in seconds
     uint32_t _internalTimeIat; // millis() at time token was issued
-    char _jwtBuffer[MAX_JWT_LENGTH];
+    PostgrestCredential _jwt;
+
+    // proactive token renewal (poll())
+    uint32_t _refreshMargin;       // seconds before expiry
+    uint32_t _refreshJitter;       // maximum random seconds added to the margin
+    uint32_t _refreshJitterOffset; // random seconds drawn for the current token
+    bool _refreshFailed;
+    unsigned long _refreshFailedAt; // millis() of the last failed renewal
+
+    // connection reuse (keep-alive mode)
+    bool _keepAlive;
+    unsigned long _keepAliveIdleTimeout;
+    PostgrestDnsCache *_dns;          // setDnsCache(), nullptr to resolve on every connect
+    PostgrestTlsSessionStore *_tlsSessions; // setTlsSessions(), nullptr for full handshakes
+    bool _tlsResumed;                 // the handshake of the open connection resumed a session
+    const char *_connectedHost;       // host of the open connection, nullptr if none
+    unsigned long _lastActivity;      // millis() when the open connection was last used
+    unsigned long _serverIdleTimeout; // from the server's Keep-Alive header, 0 if not sent
+
+    // head of the last response
+    int _statusCode;
+    long _contentLength; // -1 if not sent
+    bool _chunked;
+    bool _connectionClose;
+    bool _gzip; // Content-Encoding: gzip
+    long _contentRangeFirst; // Content-Range, -1 if not sent
+    long _contentRangeLast;
+    long _contentRangeTotal;
+    unsigned long _retryAfter; // Retry-After in seconds, 0 if not sent
+    PostgrestBodyStream _body;
+    PostgrestInflateStream _inflate; // decompresses _body if _gzip
+    bool _compression;               // setCompression()
+
+    // request writing
+    PostgrestWriteBuffer<POSTGREST_WRITE_BUFFER_SIZE> _out;
+    char *_headerBlock;        // preformatted printStaticHeaders(), nullptr until built
+    size_t _headerBlockLength;
+    long _rangeFirst; // Range of doGetPage(), -1 for other requests
+    long _rangeLast;
+    const PostgrestRequestOptions *_options; // Prefer header of the current data API request
+    const char *_onConflict;                 // on_conflict columns of doUpsert()
+    const PostgrestCsvSource *_csv;          // body of doPostCsv()
+
+    // row stream of beginRows()/nextRow()/endRows()
+    bool _rowsOpen;
+    bool _rowsDone;
+    bool _rowsSingle; // response is a single object instead of an array
+    size_t _rowsRead;
+    const char *_rowsError;
+
+    const PostgrestRetryPolicy *_retryPolicy; // setRetryPolicy(), nullptr to not retry
+    PostgrestResponseCache *_cache;           // setResponseCache(), nullptr for none
+
+#if POSTGREST_METRICS
+    // metrics of the current or last request, see onRequestMetrics()
+    PostgrestRequestMetrics _metrics;
+    PostgrestMetricsTotals _metricsTotals;
+    PostgrestMetricsCallback _metricsCallback;
+    void *_metricsContext;
+    unsigned long _metricsStart;  // micros() when the request started
+    uint32_t _metricsBodyStart;   // _body.received() when the request started
+    bool _metricsOpen;            // between beginMetrics() and endMetrics()
+    bool _tokenRefreshed;         // refreshTokenIfNeeded() renewed the token for the next data request
+#endif
 
     // payload for requests and responses - one at a time
+    PostgrestArena *_requestArena; // set by useArena(), nullptr for the heap
     JsonDocument request;
     JsonDocument response;
 };
@@ -430,7 +2394,7 @@ public:
      * all paths must start with a leading '/' and end without a trailing '/'
      */
     NeonPostgrestClient(WiFiClient &client, const char *authHost, const char *authPath, const char *apiHost, const char *apiPath)
-        : PostgrestClient(client)
+        : PostgrestClient(client), _sessionCookie(MAX_JWT_LENGTH - 1), _newJwt(MAX_JWT_LENGTH - 1)
     {
         _authHost = authHost;
         _authPath = authPath;
@@ -441,8 +2405,8 @@ public:
         _isSignedIn = false;
         _tokenExpiry = 0;
         _internalTimeIat = 0;
-        _sessionCookie[0] = '\0';
-        _jwtBuffer[0] = '\0';
+        _captureCookie = false;
+        _haveJwt = false;
         request.clear();
         response.clear();
     }
@@ -566,7 +2530,7 @@ public:
         if (err)
             return err;
 
-        if (_sessionCookie[0] == '\0')
+        if (_sessionCookie.empty())
             return "no session token in sign-in response";
 
         request.clear();
@@ -586,226 +2550,108 @@ private:
     // Neon-specific helpers (not virtual)
     const char *postJsonAuth(const char *pathSuffix, unsigned long timeout, bool setCookie = false)
     {
-        if (!connectToHost(_authHost))
-        {
-            return "cannot connect to auth host over Wifi";
-        }
-
-        _client.print("POST ");
-        _client.print(_authPath);
-        _client.print(pathSuffix);
-        _client.println(" HTTP/1.1");
-        _client.print("Host: ");
-        _client.println(_authHost);
-        _client.println("Content-Type: application/json");
-        _client.println("Accept: application/json");
-        _client.println("Origin: https://example.com");
-        _client.print("Content-Length: ");
-        size_t length = measureJson(request);
-        _client.print(length);
-        _client.print("\r\n\r\n");
-
-        size_t written = serializeJson(request, _client);
-        if (written != length)
-        {
-            _client.stop();
-            return "payload serialization error";
-        }
-        _client.flush();
-
-        unsigned long ms = millis();
-        while (!_client.available() && millis() - ms < timeout)
-        {
-            delay(0);
-        }
-
-        if (!_client.available())
-        {
-            _client.stop();
-            return "request timed out";
-        }
-
-        size_t bytes_read = _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
-        _status[bytes_read] = 0;
-        int status_code = 0;
-        if (bytes_read >= 12)
-            sscanf(_status + 9, "%3d", &status_code);
-        if (status_code < 200 || status_code >= 300)
-        {
-            _client.stop();
-            return _status;
-        }
         if (setCookie)
-        {
-            _sessionCookie[0] = '\0';
-
-            while (true)
-            {
-                size_t hlen = _client.readBytesUntil('\n', _sessionCookie, sizeof(_sessionCookie) - 1);
-                if (hlen == 0)
-                    break;
-                _sessionCookie[hlen] = 0;
-                if (hlen == 1 && _sessionCookie[0] == '\r')
-                    break;
-                const char *p = _sessionCookie;
-                while (*p == ' ' || *p == '\t')
-                    p++;
-                if (strncmp(p, "Set-Cookie:", 11) == 0 || strncmp(p, "set-cookie:", 11) == 0)
-                {
-                    const char *val = p + 11;
-                    while (*val == ' ' || *val == '\t')
-                        val++;
-                    const char *found = strstr(val, "__Secure-neon-auth.session_token=");
-                    if (found)
-                    {
-                        const char *cookie_start = found + strlen("__Secure-neon-auth.session_token=");
-                        const char *end = cookie_start;
-                        while (*end && *end != ';' && *end != '\r' && *end != '\n')
-                            end++;
-                        size_t clen = (size_t)(end - cookie_start);
-                        if (clen >= sizeof(_sessionCookie))
-                            clen = sizeof(_sessionCookie) - 1;
-                        memmove(_sessionCookie, cookie_start, clen);
-                        _sessionCookie[clen] = 0;
-                        break;
-                    }
-                }
-            }
-        }
-
-        char endOfHeaders[] = "\r\n\r\n";
-        if (!_client.find(endOfHeaders))
-        {
-            _client.stop();
-            return "Invalid response";
-        }
-
-        DeserializationError err = deserializeJson(response, _client);
-        if (err)
-        {
-            _client.stop();
-            return err.c_str();
-        }
-        _client.stop();
-        return nullptr;
+            _sessionCookie.clear();
+        _captureCookie = setCookie;
+        const char *err = invokeAuthAPI("POST", pathSuffix, timeout);
+        _captureCookie = false;
+        return err;
     }
 
     const char *getSessionJWTWithCookie(unsigned long timeout)
     {
-        if (_sessionCookie[0] == '\0')
+        if (_sessionCookie.empty())
             return "empty session token";
 
-        if (!connectToHost(_authHost))
-        {
-            return "cannot connect to auth host over Wifi";
-        }
+        _haveJwt = false;
+        const char *err = invokeAuthAPI("GET", "/get-session", timeout);
+        if (!err && !_haveJwt)
+            err = "no jwt in get-session response";
+        // the token in use is only replaced by a complete new one from a successful response
+        if (!err)
+            _jwt.swap(_newJwt);
+        _newJwt.clear();
+        if (err)
+            return err;
 
-        _client.print("GET ");
-        _client.print(_authPath);
-        _client.print("/get-session");
-        _client.println(" HTTP/1.1");
-        _client.print("Host: ");
-        _client.println(_authHost);
-        _client.println("Accept: application/json");
-        _client.println("Origin: https://example.com");
-        _client.print("Cookie: __Secure-neon-auth.session_token=");
-        _client.println(_sessionCookie);
-        _client.print("\r\n");
-        _client.flush();
+        uint32_t tokenIat = jwt_get_claim_u32_scan(_jwt.c_str(), "\"iat\"");
+        uint32_t tokenExpiry = jwt_get_claim_u32_scan(_jwt.c_str(), "\"exp\"");
+        tokenUpdated(tokenExpiry - tokenIat);
 
-        unsigned long ms = millis();
-        while (!_client.available() && millis() - ms < timeout)
-        {
-            delay(0);
-        }
-        if (!_client.available())
-        {
-            _client.stop();
-            return "get-session timed out";
-        }
+        return nullptr;
+    }
 
-        size_t bytes_read = _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
-        _status[bytes_read] = 0;
-        int status_code = 0;
-        if (bytes_read >= 12)
-            sscanf(_status + 9, "%3d", &status_code);
-        if (status_code < 200 || status_code >= 300)
-        {
-            _client.stop();
-            return _status;
-        }
+    // Neon specific members
+    PostgrestCredential _sessionCookie;
+    PostgrestCredential _newJwt; // set-auth-jwt of the current response, moved to _jwt on success
+    bool _captureCookie; // take the session token from the next Set-Cookie header that has one
+    bool _haveJwt;       // a set-auth-jwt header was received
 
-        bool haveJwt = false;
-        while (true)
-        {
-            size_t hlen = _client.readBytesUntil('\n', _jwtBuffer, sizeof(_jwtBuffer) - 1);
-            if (hlen == 0)
-                break;
-            _jwtBuffer[hlen] = 0;
-            if (hlen == 1 && _jwtBuffer[0] == '\r')
-                break;
-            const char *p = _jwtBuffer;
-            while (*p == ' ' || *p == '\t')
-                p++;
-            if (strncmp(p, "set-auth-jwt:", 13) == 0 || strncmp(p, "Set-Auth-Jwt:", 13) == 0)
-            {
-                const char *val = p + 13;
-                while (*val == ' ' || *val == '\t')
-                    val++;
-                size_t vlen = strnlen(val, sizeof(_jwtBuffer));
-                if (vlen && val[vlen - 1] == '\r')
-                    vlen--;
-                if (vlen >= sizeof(_jwtBuffer))
-                    vlen = sizeof(_jwtBuffer) - 1;
-                memmove(_jwtBuffer, val, vlen);
-                _jwtBuffer[vlen] = 0;
-                haveJwt = true;
-                break;
-            }
-        }
+protected:
+    // a valid session cookie gets a new JWT with a single get-session request
+    const char *renewSession() override
+    {
+        request.clear();
+        response.clear();
+        const char *err = getSessionJWTWithCookie(20000);
+        request.clear();
+        response.clear();
+        return err;
+    }
+
+    // Neon doesn't need extra headers, explicit no-op override
+    void addVendorSpecificHeaders(Print &out) override
+    {
+        (void)out;
+        // intentionally empty
+    }
 
-        char endOfHeaders[] = "\r\n\r\n";
-        if (!_client.find(endOfHeaders))
+    void addAuthHeaders(Print &out, const char *pathSuffix) override
+    {
+        out.println("Origin: https://example.com");
+        if (strcmp(pathSuffix, "/get-session") == 0)
         {
-            _client.stop();
-            return "Invalid response";
+            out.print("Cookie: __Secure-neon-auth.session_token=");
+            out.println(_sessionCookie.c_str());
         }
+    }
 
-        DeserializationError derr = deserializeJson(response, _client);
-        if (derr)
+    // session token from Set-Cookie (sign-in, verify-email), JWT from set-auth-jwt (get-session)
+    bool readVendorSpecificHeader(const char *name) override
+    {
+        if (strcmp(name, "set-auth-jwt") == 0)
         {
-            _client.stop();
-            return derr.c_str();
+            int end = readHeaderPart(_newJwt, '\n');
+            _haveJwt = end >= 0 && !_newJwt.empty() && !_newJwt.truncated();
+            return true;
         }
-        _client.stop();
-
-        if (!haveJwt)
+        if (_captureCookie && strcmp(name, "set-cookie") == 0)
         {
-            return "no jwt in get-session response";
+            // one cookie per header: "name=value; attributes"; only the name needs a scratch buffer
+            char cookieName[40];
+            int end = readHeaderPart(cookieName, sizeof(cookieName), '=');
+            if (end == '=' && strcmp(cookieName, "__Secure-neon-auth.session_token") == 0)
+            {
+                end = readHeaderPart(_sessionCookie, ';');
+                if (!_sessionCookie.empty() && !_sessionCookie.truncated())
+                    _captureCookie = false;
+                else
+                    _sessionCookie.clear();
+            }
+            if (end >= 0 && end != '\n')
+                skipHeaderValue();
+            return true;
         }
-
-        uint32_t tokenIat = jwt_get_claim_u32_scan(_jwtBuffer, "\"iat\"");
-        uint32_t tokenExpiry = jwt_get_claim_u32_scan(_jwtBuffer, "\"exp\"");
-        _tokenExpiry = tokenExpiry - tokenIat;
-        _internalTimeIat = millis();
-        _isSignedIn = true;
-
-        return nullptr;
-    }
-
-    // Neon specific members
-    char _sessionCookie[MAX_JWT_LENGTH];
-
-protected:
-    // Neon doesn't need extra headers, explicit no-op override
-    void addVendorSpecificHeaders() override
-    {
-        // intentionally empty
+        return false;
     }
 
-    void readVendorSpecificResponse() override
+public:
+    PostgrestMemoryStats getMemoryStats() const override
     {
-        // intentionally empty
+        PostgrestMemoryStats stats = PostgrestClient::getMemoryStats();
+        stats.clientSize = sizeof(NeonPostgrestClient);
+        stats.credentialHeap += _sessionCookie.heapSize() + _newJwt.heapSize();
+        return stats;
     }
 };
 
@@ -837,7 +2683,7 @@ public:
      * ANON_PUBLIC_KEY = "your_supabase_project_anon_public_key_here"
      */
     SupabasePostgrestClient(WiFiClient &client, const char *authHost, const char *authPath, const char *apiHost, const char *apiPath, const char *anonymousPublicApiKey)
-        : PostgrestClient(client)
+        : PostgrestClient(client), _refreshToken(MAX_JWT_LENGTH - 1)
     {
         _authHost = authHost;
         _authPath = authPath;
@@ -849,7 +2695,6 @@ public:
         _isSignedIn = false;
         _tokenExpiry = 0;
         _internalTimeIat = 0;
-        _jwtBuffer[0] = '\0';
         request.clear();
         response.clear();
     }
@@ -899,11 +2744,6 @@ public:
      */
     const char *signIn(const char *email, const char *password) override
     {
-        if (!connectToHost(_authHost))
-        {
-            return "cannot connect to auth host over Wifi";
-        }
-
         _email = email;
         _password = password;
 
@@ -912,117 +2752,93 @@ public:
         request["email"] = email;
         request["password"] = password;
 
-        _client.print("POST ");
-        _client.print(_authPath);
-        _client.print("/token?grant_type=password");
-        _client.println(" HTTP/1.1");
-        _client.print("Host: ");
-        _client.println(_authHost);
-        _client.println("Content-Type: application/json");
-        _client.println("Accept: application/json");
-        _client.print("apikey: ");
-        _client.println(_apiKey);
-        _client.print("Content-Length: ");
-        size_t length = measureJson(request);
-        _client.print(length);
-        _client.print("\r\n\r\n");
-
-        size_t written = serializeJson(request, _client);
-        if (written != length)
-        {
-            _client.stop();
-            return "payload serialization error";
-        }
-        _client.flush();
-
-        unsigned long ms = millis();
-        while (!_client.available() && millis() - ms < 20000)
-        {
-            delay(0);
-        }
-
-        if (!_client.available())
-        {
-            _client.stop();
-            return "request timed out";
-        }
+        const char *err = invokeAuthAPI("POST", "/token?grant_type=password", 20000);
+        if (err)
+            return err;
 
-        size_t bytes_read = _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
-        _status[bytes_read] = 0;
-        // Serial.println(_status);
-        int status_code = 0;
-        if (bytes_read >= 12)
-            sscanf(_status + 9, "%3d", &status_code);
-        if (status_code < 200 || status_code >= 300)
-        {
-            _client.stop();
-            return _status;
-        }
+        err = acceptTokenResponse();
+        if (err)
+            return err;
 
-        char endOfHeaders[] = "\r\n\r\n";
-        if (!_client.find(endOfHeaders))
-        {
-            _client.stop();
-            return "Invalid response";
-        }
+        request.clear();
+        response.clear();
 
-        readVendorSpecificResponse();
+        return nullptr;
+    }
 
-        DeserializationError err = deserializeJson(response, _client);
-        if (err)
-        {
-            _client.stop();
-            return err.c_str();
-        }
+private:
+    // take access token, lifetime and refresh token from a /token response
+    const char *acceptTokenResponse()
+    {
         const char *jwt = response["access_token"].as<const char *>();
         if (!jwt)
-        {
-            _client.stop();
             return "no access_token in sign-in response";
-        }
         size_t jlen = strnlen(jwt, MAX_JWT_LENGTH);
         if (jlen == 0 || jlen >= MAX_JWT_LENGTH)
-        {
-            _client.stop();
             return "invalid access_token length";
-        }
-        memmove(_jwtBuffer, jwt, jlen);
-        _jwtBuffer[jlen] = '\0';
-        _tokenExpiry = response["expires_in"].as<uint32_t>();
-        _internalTimeIat = millis();
-        _isSignedIn = true;
+        if (!_jwt.set(jwt, jlen))
+            return "out of memory for access_token";
 
-        request.clear();
-        response.clear();
+        // refresh tokens are single use, the response always carries the next one
+        const char *refresh = response["refresh_token"].as<const char *>();
+        if (!refresh || !_refreshToken.set(refresh, strlen(refresh)))
+            _refreshToken.clear(); // renewal falls back to sign-in
 
-        _client.stop();
+        tokenUpdated(response["expires_in"].as<uint32_t>());
         return nullptr;
     }
 
-private:
     /**
      * @brief Supabase-specific member: anonymous public API key for adding to headers
      * all requests to Supabase services require this header
      */
     const char *_apiKey;
+    PostgrestCredential _refreshToken; // from the last /token response, empty if none
 
 protected:
+    // exchange the refresh token for a new access token ("<SUPABASE_AUTH_URL>/token?grant_type=refresh_token")
+    const char *renewSession() override
+    {
+        if (_refreshToken.empty())
+            return "no refresh token";
+        request.clear();
+        response.clear();
+        request["refresh_token"] = _refreshToken.c_str();
+        const char *err = invokeAuthAPI("POST", "/token?grant_type=refresh_token", 20000);
+        if (!err)
+            err = acceptTokenResponse();
+        else if (!lastErrorIsTransient())
+            _refreshToken.clear(); // revoked or already used
+        request.clear();
+        response.clear();
+        return err;
+    }
+
     /**
      * @brief  Add Supabase-specific headers (anonymous public API key)
      */
-    void addVendorSpecificHeaders() override
+    void addVendorSpecificHeaders(Print &out) override
     {
         if (_apiKey && _apiKey[0])
         {
-            _client.print("apikey: ");
-            _client.println(_apiKey);
+            out.print("apikey: ");
+            out.println(_apiKey);
         }
     }
 
-    // skip line in response before json payload
-    void readVendorSpecificResponse() override
+    void addAuthHeaders(Print &out, const char *pathSuffix) override
+    {
+        (void)pathSuffix;
+        addVendorSpecificHeaders(out);
+    }
+
+public:
+    PostgrestMemoryStats getMemoryStats() const override
     {
-        _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
+        PostgrestMemoryStats stats = PostgrestClient::getMemoryStats();
+        stats.clientSize = sizeof(SupabasePostgrestClient);
+        stats.credentialHeap += _refreshToken.heapSize();
+        return stats;
     }
 };
 
@@ -1051,12 +2867,12 @@ public:
         _apiHost = apiHost;
         _port = port;
         _apiPath = apiPath;
+        _refreshRpc = nullptr;
         _email = nullptr;
         _password = nullptr;
         _isSignedIn = false;
         _tokenExpiry = 0;
         _internalTimeIat = 0;
-        _jwtBuffer[0] = '\0';
         request.clear();
         response.clear();
     }
@@ -1106,11 +2922,6 @@ public:
      */
     const char *signIn(const char *email, const char *password) override
     {
-        if (!connectToHost(_authHost))
-        {
-            return "cannot connect to auth host over Wifi";
-        }
-
         _email = email;
         _password = password;
 
@@ -1119,101 +2930,78 @@ public:
         request["email"] = email;
         request["password"] = password;
 
-        _client.print("POST ");
-        _client.print(_authPath);
-        _client.print("/rpc/login");
-        _client.println(" HTTP/1.1");
-        _client.print("Host: ");
-        _client.println(_authHost);
-        _client.println("Content-Type: application/json");
-        _client.println("Accept: application/json");
-        _client.println("Content-Profile: auth");
-        _client.print("Content-Length: ");
-        size_t length = measureJson(request);
-        _client.print(length);
-        _client.print("\r\n\r\n");
-
-        size_t written = serializeJson(request, _client);
-        if (written != length)
-        {
-            _client.stop();
-            return "payload serialization error";
-        }
-        _client.flush();
-
-        unsigned long ms = millis();
-        while (!_client.available() && millis() - ms < 20000)
-        {
-            delay(0);
-        }
+        const char *err = invokeAuthAPI("POST", "/rpc/login", 20000);
+        if (err)
+            return err;
 
-        if (!_client.available())
-        {
-            _client.stop();
-            return "request timed out";
-        }
+        err = acceptTokenResponse();
+        if (err)
+            return err;
 
-        size_t bytes_read = _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
-        _status[bytes_read] = 0;
-        // Serial.println(_status);
-        int status_code = 0;
-        if (bytes_read >= 12)
-            sscanf(_status + 9, "%3d", &status_code);
-        if (status_code < 200 || status_code >= 300)
-        {
-            _client.stop();
-            return _status;
-        }
+        request.clear();
+        response.clear();
 
-        char endOfHeaders[] = "\r\n\r\n";
-        if (!_client.find(endOfHeaders))
-        {
-            _client.stop();
-            return "Invalid response";
-        }
+        return nullptr;
+    }
 
-        readVendorSpecificResponse();
+    /**
+     * @brief Renew tokens with an RPC in schema auth instead of signing in again.
+     * The RPC is called with the current token and must return {"token": "<new jwt>"} like
+     * auth.login, see auth.refresh_token in the curlscripts_selfhosted folder's README.md.
+     *
+     * @param route RPC route like "/rpc/refresh_token", nullptr to always sign in again
+     */
+    void setRefreshRpc(const char *route)
+    {
+        _refreshRpc = route;
+    }
 
-        DeserializationError err = deserializeJson(response, _client);
-        if (err)
-        {
-            _client.stop();
-            return err.c_str();
-        }
+private:
+    // take the token from a login or refresh response
+    const char *acceptTokenResponse()
+    {
         const char *jwt = response["token"].as<const char *>();
         if (!jwt)
-        {
-            _client.stop();
             return "no access_token in sign-in response";
-        }
         size_t jlen = strnlen(jwt, MAX_JWT_LENGTH);
         if (jlen == 0 || jlen >= MAX_JWT_LENGTH)
-        {
-            _client.stop();
             return "invalid access_token length";
-        }
-        memmove(_jwtBuffer, jwt, jlen);
-        _jwtBuffer[jlen] = '\0';
-        uint32_t tokenIat = jwt_get_claim_u32_scan(_jwtBuffer, "\"iat\"");
-        uint32_t tokenExpiry = jwt_get_claim_u32_scan(_jwtBuffer, "\"exp\"");
-        _tokenExpiry = tokenExpiry - tokenIat;
-        _internalTimeIat = millis();
-        _isSignedIn = true;
+        if (!_jwt.set(jwt, jlen))
+            return "out of memory for access_token";
+        uint32_t tokenIat = jwt_get_claim_u32_scan(_jwt.c_str(), "\"iat\"");
+        uint32_t tokenExpiry = jwt_get_claim_u32_scan(_jwt.c_str(), "\"exp\"");
+        tokenUpdated(tokenExpiry - tokenIat);
+        return nullptr;
+    }
+
+    const char *_refreshRpc; // see setRefreshRpc()
 
+protected:
+    const char *renewSession() override
+    {
+        if (!_refreshRpc)
+            return "no refresh rpc configured";
         request.clear();
         response.clear();
-
-        _client.stop();
-        return nullptr;
+        request.to<JsonObject>(); // no arguments: {}
+        const char *err = invokeAuthAPI("POST", _refreshRpc, 20000);
+        if (!err)
+            err = acceptTokenResponse();
+        request.clear();
+        response.clear();
+        return err;
     }
 
-private:
-protected:
-    // // skip line in response before json payload
-    // void readVendorSpecificResponse() override
-    // {
-    //     _client.readBytesUntil('\n', _status, sizeof(_status) - 1);
-    // }
+    // the login function lives in schema auth, the refresh RPC also needs the current token
+    void addAuthHeaders(Print &out, const char *pathSuffix) override
+    {
+        out.println("Content-Profile: auth");
+        if (_refreshRpc && strcmp(pathSuffix, _refreshRpc) == 0)
+        {
+            out.print("Authorization: Bearer ");
+            out.println(_jwt.c_str());
+        }
+    }
 };
 
 static const char *
@@ -1308,4 +3096,9 @@ uint32_t jwt_get_claim_u32_scan(const char *jwt, const char *claim)
     return v;
 }
 
+#include "PostgrestOfflineQueue.h"
+#include "PostgrestBatch.h"
+#include "PostgrestPager.h"
+#include "PostgrestAsyncRequest.h"
+
 #endif // POSTGRESTCLIENT_H
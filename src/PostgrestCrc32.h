@@ -0,0 +1,25 @@
+#ifndef POSTGRESTCRC32_H
+#define POSTGRESTCRC32_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief CRC-32 (IEEE 802.3, as used by zlib/gzip) with a 16 entry table to save flash.
+ * Start with crc = 0 and pass the previous result to continue over several buffers.
+ */
+static inline uint32_t postgrest_crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    crc = ~crc;
+    while (length--)
+    {
+        crc = table[(crc ^ *data) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (*data >> 4)) & 0x0f] ^ (crc >> 4);
+        data++;
+    }
+    return ~crc;
+}
+
+#endif // POSTGRESTCRC32_H
@@ -0,0 +1,170 @@
+#ifndef POSTGRESTCREDENTIAL_H
+#define POSTGRESTCREDENTIAL_H
+#include <Arduino.h>
+
+/**
+ * @brief A token or cookie kept in a heap block sized to the actual value, instead of a
+ * fixed buffer of the largest possible size per credential.
+ * Values can be set at once with set() or built byte by byte while they are read from a
+ * response (begin(), append(), shrink()).
+ */
+class PostgrestCredential
+{
+public:
+    /**
+     * @param maxLength longest value that is accepted (not preallocated)
+     */
+    explicit PostgrestCredential(size_t maxLength) : _value(nullptr), _length(0), _capacity(0), _maxLength(maxLength), _truncated(false) {}
+
+    ~PostgrestCredential()
+    {
+        free(_value);
+    }
+
+    PostgrestCredential(const PostgrestCredential &) = delete;
+    PostgrestCredential &operator=(const PostgrestCredential &) = delete;
+
+    /**
+     * @brief Replace the value
+     *
+     * @return true value stored
+     * @return false value too long or out of memory, the old value is kept
+     */
+    bool set(const char *value, size_t length)
+    {
+        if (length > _maxLength)
+            return false;
+        char *block = (char *)malloc(length + 1);
+        if (!block)
+            return false;
+        memcpy(block, value, length);
+        block[length] = '\0';
+        free(_value);
+        _value = block;
+        _length = length;
+        _capacity = length + 1;
+        _truncated = false;
+        return true;
+    }
+
+    // exchange the values (and their memory) with other, e.g. to replace a token in use only
+    // once its successor was read completely
+    void swap(PostgrestCredential &other)
+    {
+        char *value = _value;
+        size_t length = _length;
+        size_t capacity = _capacity;
+        bool truncated = _truncated;
+        _value = other._value;
+        _length = other._length;
+        _capacity = other._capacity;
+        _truncated = other._truncated;
+        other._value = value;
+        other._length = length;
+        other._capacity = capacity;
+        other._truncated = truncated;
+    }
+
+    // drop the value and its memory
+    void clear()
+    {
+        free(_value);
+        _value = nullptr;
+        _length = 0;
+        _capacity = 0;
+        _truncated = false;
+    }
+
+    // start building a new value with append(), keeps the memory of the old one
+    void begin()
+    {
+        _length = 0;
+        _truncated = false;
+        if (_value)
+            _value[0] = '\0';
+    }
+
+    /**
+     * @brief Add a character to the value started with begin(), growing the block as needed
+     *
+     * @return false the value would exceed maxLength or memory is exhausted; the character is
+     * dropped and truncated() returns true
+     */
+    bool append(char c)
+    {
+        if (_length + 2 > _capacity) // character and terminator
+        {
+            size_t capacity = _capacity < 32 ? 64 : _capacity * 2;
+            if (capacity > _maxLength + 1)
+                capacity = _maxLength + 1;
+            char *block = _length + 2 <= capacity ? (char *)realloc(_value, capacity) : nullptr;
+            if (!block)
+            {
+                _truncated = true;
+                return false;
+            }
+            _value = block;
+            _capacity = capacity;
+        }
+        _value[_length++] = c;
+        _value[_length] = '\0';
+        return true;
+    }
+
+    // release unused memory after the value was built with append()
+    void shrink()
+    {
+        if (_length == 0)
+        {
+            bool truncated = _truncated;
+            clear();
+            _truncated = truncated;
+            return;
+        }
+        if (_capacity > _length + 1)
+        {
+            char *block = (char *)realloc(_value, _length + 1);
+            if (block)
+            {
+                _value = block;
+                _capacity = _length + 1;
+            }
+        }
+    }
+
+    const char *c_str() const
+    {
+        return _value ? _value : "";
+    }
+
+    size_t length() const
+    {
+        return _length;
+    }
+
+    bool empty() const
+    {
+        return _length == 0;
+    }
+
+    // true if append() dropped characters since begin()
+    bool truncated() const
+    {
+        return _truncated;
+    }
+
+    // heap bytes held by this credential
+    size_t heapSize() const
+    {
+        return _capacity;
+    }
+
+private:
+    char *_value;
+    size_t _length;
+    size_t _capacity;
+    size_t _maxLength;
+    bool _truncated;
+};
+
+#endif // POSTGRESTCREDENTIAL_H
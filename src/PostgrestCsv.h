@@ -0,0 +1,136 @@
+#ifndef POSTGRESTCSV_H
+#define POSTGRESTCSV_H
+#include <Arduino.h>
+
+/**
+ * @brief Writes CSV (RFC 4180) rows to a Print, e.g. the request body of
+ * PostgrestClient::doPostCsv(). Fields are separated automatically; text is quoted only if
+ * it contains a comma, quote or line break, or if it is NULL.
+ */
+class PostgrestCsvWriter
+{
+public:
+    explicit PostgrestCsvWriter(Print &out) : _out(out), _fields(0), _length(0) {}
+
+    // the header line: column names separated by commas, written as they are
+    void header(const char *columns)
+    {
+        _length += _out.print(columns);
+        endRow();
+    }
+
+    PostgrestCsvWriter &field(const char *text)
+    {
+        if (!text)
+            return fieldNull();
+        separate();
+        // the unquoted text NULL would be read as null, see fieldNull()
+        bool quote = strpbrk(text, ",\"\r\n") != nullptr || strcmp(text, "NULL") == 0;
+        if (!quote)
+        {
+            _length += _out.print(text);
+            return *this;
+        }
+        _length += _out.print('"');
+        for (const char *p = text; *p; p++)
+        {
+            if (*p == '"')
+                _length += _out.print('"'); // quotes are doubled
+            _length += _out.print(*p);
+        }
+        _length += _out.print('"');
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(const String &text)
+    {
+        return field(text.c_str());
+    }
+
+    PostgrestCsvWriter &field(int value)
+    {
+        separate();
+        _length += _out.print(value);
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(long value)
+    {
+        separate();
+        _length += _out.print(value);
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(unsigned int value)
+    {
+        separate();
+        _length += _out.print(value);
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(unsigned long value)
+    {
+        separate();
+        _length += _out.print(value);
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(double value, int digits = 2)
+    {
+        separate();
+        _length += _out.print(value, digits);
+        return *this;
+    }
+
+    PostgrestCsvWriter &field(bool value)
+    {
+        separate();
+        _length += _out.print(value ? "true" : "false");
+        return *this;
+    }
+
+    // NULL (PostgREST reads the unquoted text NULL as null)
+    PostgrestCsvWriter &fieldNull()
+    {
+        separate();
+        _length += _out.print("NULL");
+        return *this;
+    }
+
+    void endRow()
+    {
+        _length += _out.print('\n');
+        _fields = 0;
+    }
+
+    // bytes written so far
+    size_t length() const
+    {
+        return _length;
+    }
+
+private:
+    void separate()
+    {
+        if (_fields++ > 0)
+            _length += _out.print(',');
+    }
+
+    Print &_out;
+    size_t _fields; // fields in the current row
+    size_t _length;
+};
+
+/**
+ * @brief Callback that writes the fields of one row of a CSV body, see PostgrestClient::doPostCsv()
+ * It may be called more than once for the same row (to measure the body, or to send it again
+ * on a new connection) and must write the same fields each time.
+ *
+ * @param csv writer for the fields of the row
+ * @param row index of the row, starting at 0
+ * @param context pointer passed to doPostCsv()
+ * @return true if a row was written, false (without writing fields) after the last row
+ */
+typedef bool (*PostgrestCsvRowCallback)(PostgrestCsvWriter &csv, size_t row, void *context);
+
+#endif // POSTGRESTCSV_H
@@ -0,0 +1,190 @@
+#ifndef POSTGRESTDNSCACHE_H
+#define POSTGRESTDNSCACHE_H
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+// number of host names a PostgrestDnsCache remembers (auth and data API host, plus spares)
+#ifndef POSTGREST_DNS_CACHE_SIZE
+#define POSTGREST_DNS_CACHE_SIZE 4
+#endif
+
+/**
+ * @brief Resolves a host name for PostgrestDnsCache, typically with the WiFi library:
+ *   bool resolve(const char *host, IPAddress &address, void *)
+ *   {
+ *       return WiFi.hostByName(host, address) == 1;
+ *   }
+ *
+ * @return true if address was set
+ */
+typedef bool (*PostgrestResolver)(const char *host, IPAddress &address, void *context);
+
+/**
+ * @brief Opens a connection to a resolved address for PostgrestDnsCache.
+ * TLS clients need the host name for SNI and certificate validation, so a TLS connection must be
+ * opened with both, e.g. on ESP32:
+ *   bool connectTls(WiFiClient &client, IPAddress address, const char *host, uint16_t port, void *)
+ *   {
+ *       return static_cast<WiFiClientSecure &>(client).connect(address, port, host, nullptr, nullptr, nullptr);
+ *   }
+ * Without a connector client.connect(address, port) is used, which is only right for plain HTTP.
+ *
+ * @return true if connected
+ */
+typedef bool (*PostgrestConnector)(WiFiClient &client, IPAddress address, const char *host, uint16_t port, void *context);
+
+/**
+ * @brief Remembers resolved addresses of the auth and data API hosts, so that requests don't
+ * wait for a DNS lookup every time they connect, see PostgrestClient::setDnsCache().
+ * The Arduino resolvers don't report the TTL of a record, so addresses are kept for a fixed
+ * time (ttl). If connecting to a cached address fails, the host is resolved again and the new
+ * address tried once. If resolving fails, an expired address is used rather than none.
+ * Host names are stored as pointers and must stay valid, like the ones passed to the clients.
+ *
+ * Usage:
+ *   PostgrestDnsCache dns(resolve, connectTls); // callbacks see PostgrestResolver and PostgrestConnector
+ *   pgClient.setDnsCache(&dns);
+ */
+class PostgrestDnsCache
+{
+public:
+    /**
+     * @param resolver resolves host names
+     * @param connector connects to an address, nullptr for client.connect(address, port)
+     * @param context passed to resolver and connector
+     * @param ttl milliseconds an address is used before it is resolved again
+     */
+    explicit PostgrestDnsCache(PostgrestResolver resolver, PostgrestConnector connector = nullptr, void *context = nullptr,
+                               unsigned long ttl = 300000UL)
+        : _resolver(resolver), _connector(connector), _context(context), _ttl(ttl), _hits(0), _lookups(0), _failures(0)
+    {
+        clear();
+    }
+
+    /**
+     * @brief Connect client to host, using the cached address if it is still fresh
+     *
+     * @return true if connected
+     */
+    bool connect(WiFiClient &client, const char *host, uint16_t port)
+    {
+        Entry *entry = find(host);
+        bool cached = entry && millis() - entry->resolvedAt < _ttl;
+        if (cached)
+            _hits++;
+        else
+            entry = resolve(host, entry);
+        if (!entry)
+            return false;
+        if (connectTo(client, entry->address, host, port))
+            return true;
+        if (!cached)
+            return false;
+
+        // the host may have moved: try a new address once
+        IPAddress failed = entry->address;
+        entry = resolve(host, entry);
+        if (!entry || entry->address == failed)
+            return false;
+        return connectTo(client, entry->address, host, port);
+    }
+
+    // forget all addresses, e.g. after joining another network
+    void clear()
+    {
+        for (size_t i = 0; i < POSTGREST_DNS_CACHE_SIZE; i++)
+            _entries[i].host = nullptr;
+    }
+
+    // connections that used a cached address without a lookup
+    uint32_t hits() const
+    {
+        return _hits;
+    }
+
+    // calls of the resolver
+    uint32_t lookups() const
+    {
+        return _lookups;
+    }
+
+    // lookups that failed
+    uint32_t failures() const
+    {
+        return _failures;
+    }
+
+private:
+    struct Entry
+    {
+        const char *host; // nullptr if unused
+        IPAddress address;
+        unsigned long resolvedAt; // millis()
+    };
+
+    Entry *find(const char *host)
+    {
+        for (size_t i = 0; i < POSTGREST_DNS_CACHE_SIZE; i++)
+        {
+            const char *cached = _entries[i].host;
+            if (cached && (cached == host || strcmp(cached, host) == 0))
+                return &_entries[i];
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Look up host and store its address in entry (or a free or the oldest entry)
+     *
+     * @return Entry* with the new address, entry with its previous address if the lookup failed,
+     * nullptr if there is no address at all
+     */
+    Entry *resolve(const char *host, Entry *entry)
+    {
+        IPAddress address;
+        _lookups++;
+        if (!_resolver || !_resolver(host, address, _context))
+        {
+            _failures++;
+            return entry;
+        }
+        if (!entry)
+            entry = unusedEntry();
+        entry->host = host;
+        entry->address = address;
+        entry->resolvedAt = millis();
+        return entry;
+    }
+
+    // free entry, otherwise the one resolved longest ago
+    Entry *unusedEntry()
+    {
+        Entry *oldest = &_entries[0];
+        for (size_t i = 0; i < POSTGREST_DNS_CACHE_SIZE; i++)
+        {
+            if (!_entries[i].host)
+                return &_entries[i];
+            if (millis() - _entries[i].resolvedAt > millis() - oldest->resolvedAt)
+                oldest = &_entries[i];
+        }
+        return oldest;
+    }
+
+    bool connectTo(WiFiClient &client, IPAddress address, const char *host, uint16_t port)
+    {
+        if (_connector)
+            return _connector(client, address, host, port, _context);
+        return client.connect(address, port);
+    }
+
+    PostgrestResolver _resolver;
+    PostgrestConnector _connector;
+    void *_context;
+    unsigned long _ttl;
+    uint32_t _hits;
+    uint32_t _lookups;
+    uint32_t _failures;
+    Entry _entries[POSTGREST_DNS_CACHE_SIZE];
+};
+
+#endif // POSTGRESTDNSCACHE_H
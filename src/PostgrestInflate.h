@@ -0,0 +1,552 @@
+#ifndef POSTGRESTINFLATE_H
+#define POSTGRESTINFLATE_H
+#include <Arduino.h>
+#include "PostgrestCrc32.h"
+
+// history kept for back references; gzip encoders use up to 32 KB (zlib default), a smaller
+// window only works with servers that are configured to compress with a smaller one
+#ifndef POSTGREST_INFLATE_WINDOW
+#define POSTGREST_INFLATE_WINDOW 32768
+#endif
+
+/**
+ * @brief Stream that decompresses a gzip (RFC 1952 / DEFLATE RFC 1951) body while it is read,
+ * e.g. a response with "Content-Encoding: gzip". deserializeJson() can read from it like from
+ * the connection. Decompressed bytes are produced one at a time; only the window of the last
+ * POSTGREST_INFLATE_WINDOW bytes and the Huffman tables are kept, in one heap block that is
+ * allocated by allocate() and reported by heapSize().
+ * Compressed bytes are read blocking up to the source's timeout. The CRC and length in the
+ * gzip trailer are verified at the end of the body.
+ */
+class PostgrestInflateStream : public Stream
+{
+public:
+    PostgrestInflateStream() : _memory(nullptr), _source(nullptr), _state(FAILED), _error(nullptr), _peek(-1) {}
+
+    ~PostgrestInflateStream()
+    {
+        free(_memory);
+    }
+
+    PostgrestInflateStream(const PostgrestInflateStream &) = delete;
+    PostgrestInflateStream &operator=(const PostgrestInflateStream &) = delete;
+
+    // allocate window and tables, false if out of memory
+    bool allocate()
+    {
+        if (!_memory)
+            _memory = (Memory *)malloc(sizeof(Memory));
+        return _memory != nullptr;
+    }
+
+    void release()
+    {
+        free(_memory);
+        _memory = nullptr;
+    }
+
+    // heap bytes held for decompression
+    size_t heapSize() const
+    {
+        return _memory ? sizeof(Memory) : 0;
+    }
+
+    /**
+     * @brief Start decompressing a gzip body
+     *
+     * @param source the compressed body
+     */
+    void begin(Stream &source)
+    {
+        _source = &source;
+        _state = GZIP_HEADER;
+        _error = nullptr;
+        _peek = -1;
+        _bitBuffer = 0;
+        _bitCount = 0;
+        _position = 0;
+        _filled = 0;
+        _crc = 0;
+        _copyLength = 0;
+        if (!_memory)
+            fail("gzip response, but compression is not enabled");
+    }
+
+    // true at the end of the decompressed data or after an error
+    bool finished() const
+    {
+        return _peek < 0 && (_state == DONE || _state == FAILED);
+    }
+
+    // error message if the compressed data was invalid or incomplete, nullptr otherwise
+    const char *error() const
+    {
+        return _error;
+    }
+
+    int available() override
+    {
+        if (_peek >= 0 || (_state == COPY && _copyLength > 0))
+            return 1;
+        if (_state == DONE || _state == FAILED)
+            return 0;
+        return _source->available() > 0 ? 1 : 0;
+    }
+
+    int read() override
+    {
+        int c = peek();
+        _peek = -1;
+        return c;
+    }
+
+    int peek() override
+    {
+        if (_peek < 0)
+            _peek = next();
+        return _peek;
+    }
+
+    size_t write(uint8_t) override
+    {
+        return 0; // read-only
+    }
+
+private:
+    enum State
+    {
+        GZIP_HEADER,
+        BLOCK,   // next is a block header
+        STORED,  // _storedLength bytes of an uncompressed block follow
+        CODES,   // Huffman coded symbols follow
+        COPY,    // _copyLength bytes are copied from _distance back
+        TRAILER, // CRC and length
+        DONE,
+        FAILED
+    };
+
+    static const size_t WINDOW = POSTGREST_INFLATE_WINDOW;
+    static_assert((WINDOW & (WINDOW - 1)) == 0, "POSTGREST_INFLATE_WINDOW must be a power of 2");
+    static const int MAX_BITS = 15;
+
+    struct Huffman
+    {
+        uint16_t count[MAX_BITS + 1]; // number of codes of each length
+        uint16_t symbol[288];         // symbols ordered by code
+    };
+
+    struct Memory
+    {
+        uint8_t window[WINDOW];
+        Huffman lengths;
+        Huffman distances;
+    };
+
+    int fail(const char *error)
+    {
+        if (!_error)
+            _error = error;
+        _state = FAILED;
+        return -1;
+    }
+
+    bool reject(const char *error)
+    {
+        fail(error);
+        return false;
+    }
+
+    // next decompressed byte, -1 at the end or on error
+    int next()
+    {
+        while (true)
+        {
+            switch (_state)
+            {
+            case COPY:
+                if (_copyLength > 0)
+                {
+                    _copyLength--;
+                    return emit(_memory->window[(_position - _distance) % WINDOW]);
+                }
+                _state = CODES;
+                break;
+            case STORED:
+                if (_storedLength > 0)
+                {
+                    int c = readByte();
+                    if (c < 0)
+                        return fail("gzip data incomplete");
+                    _storedLength--;
+                    return emit((uint8_t)c);
+                }
+                _state = _lastBlock ? TRAILER : BLOCK;
+                break;
+            case CODES:
+            {
+                int symbol = decode(_memory->lengths);
+                if (symbol < 0)
+                    return fail(symbol == -1 ? "gzip data incomplete" : "invalid gzip data");
+                if (symbol < 256)
+                    return emit((uint8_t)symbol);
+                if (symbol == 256)
+                {
+                    _state = _lastBlock ? TRAILER : BLOCK;
+                    break;
+                }
+                if (!readCopy(symbol - 257))
+                    return -1;
+                break;
+            }
+            case BLOCK:
+                if (!readBlockHeader())
+                    return -1;
+                break;
+            case GZIP_HEADER:
+                if (!readGzipHeader())
+                    return -1;
+                _state = BLOCK;
+                break;
+            case TRAILER:
+                readTrailer();
+                return -1;
+            default:
+                return -1;
+            }
+        }
+    }
+
+    int emit(uint8_t c)
+    {
+        _memory->window[_position % WINDOW] = c;
+        _position++;
+        if (_filled < WINDOW)
+            _filled++;
+        _crc = postgrest_crc32(_crc, &c, 1);
+        return c;
+    }
+
+    int readByte()
+    {
+        char c;
+        if (_source->readBytes(&c, 1) != 1)
+            return -1;
+        return (unsigned char)c;
+    }
+
+    // next need bits (LSB first), -1 if the source ended
+    long bits(int need)
+    {
+        uint32_t value = _bitBuffer;
+        while (_bitCount < need)
+        {
+            int c = readByte();
+            if (c < 0)
+                return -1;
+            value |= (uint32_t)c << _bitCount;
+            _bitCount += 8;
+        }
+        _bitBuffer = value >> need;
+        _bitCount -= need;
+        return (long)(value & ((1UL << need) - 1));
+    }
+
+    // byte aligned little endian value of n bytes, false if the source ended
+    bool readLittleEndian(int n, uint32_t &value)
+    {
+        value = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int c = readByte();
+            if (c < 0)
+                return false;
+            value |= (uint32_t)c << (8 * i);
+        }
+        return true;
+    }
+
+    // symbol of the next code, -1 if the source ended, -2 for an invalid code
+    int decode(const Huffman &h)
+    {
+        int code = 0, first = 0, index = 0;
+        for (int length = 1; length <= MAX_BITS; length++)
+        {
+            long bit = bits(1);
+            if (bit < 0)
+                return -1;
+            code |= (int)bit;
+            int count = h.count[length];
+            if (code - count < first)
+                return h.symbol[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -2;
+    }
+
+    /**
+     * @brief Build canonical Huffman decoding tables from code lengths
+     *
+     * @return int 0 complete code, > 0 incomplete code, < 0 over-subscribed (invalid)
+     */
+    static int construct(Huffman &h, const uint8_t *length, int n)
+    {
+        for (int len = 0; len <= MAX_BITS; len++)
+            h.count[len] = 0;
+        for (int symbol = 0; symbol < n; symbol++)
+            h.count[length[symbol]]++;
+        if (h.count[0] == n)
+            return 0;
+        int left = 1;
+        for (int len = 1; len <= MAX_BITS; len++)
+        {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0)
+                return left;
+        }
+        uint16_t offsets[MAX_BITS + 1];
+        offsets[1] = 0;
+        for (int len = 1; len < MAX_BITS; len++)
+            offsets[len + 1] = offsets[len] + h.count[len];
+        for (int symbol = 0; symbol < n; symbol++)
+        {
+            if (length[symbol] != 0)
+                h.symbol[offsets[length[symbol]]++] = (uint16_t)symbol;
+        }
+        return left;
+    }
+
+    bool readGzipHeader()
+    {
+        uint8_t head[10];
+        for (int i = 0; i < 10; i++)
+        {
+            int c = readByte();
+            if (c < 0)
+                return reject("gzip data incomplete");
+            head[i] = (uint8_t)c;
+        }
+        if (head[0] != 0x1f || head[1] != 0x8b || head[2] != 8)
+            return reject("invalid gzip header");
+        uint8_t flags = head[3];
+        if (flags & 0x04) // FEXTRA
+        {
+            uint32_t length;
+            if (!readLittleEndian(2, length))
+                return reject("gzip data incomplete");
+            while (length-- > 0)
+            {
+                if (readByte() < 0)
+                    return reject("gzip data incomplete");
+            }
+        }
+        for (uint8_t flag = 0x08; flag <= 0x10; flag <<= 1) // FNAME, FCOMMENT: zero terminated
+        {
+            if (!(flags & flag))
+                continue;
+            int c;
+            while ((c = readByte()) > 0)
+            {
+            }
+            if (c < 0)
+                return reject("gzip data incomplete");
+        }
+        uint32_t headerCrc;
+        if ((flags & 0x02) && !readLittleEndian(2, headerCrc)) // FHCRC, not checked
+            return reject("gzip data incomplete");
+        return true;
+    }
+
+    bool readBlockHeader()
+    {
+        long last = bits(1);
+        long type = bits(2);
+        if (last < 0 || type < 0)
+            return reject("gzip data incomplete");
+        _lastBlock = last != 0;
+        if (type == 0)
+        {
+            // stored block: byte aligned LEN and its complement
+            _bitBuffer = 0;
+            _bitCount = 0;
+            uint32_t length, complement;
+            if (!readLittleEndian(2, length) || !readLittleEndian(2, complement))
+                return reject("gzip data incomplete");
+            if ((length ^ 0xffff) != complement)
+                return reject("invalid gzip data");
+            _storedLength = (uint16_t)length;
+            _state = STORED;
+            return true;
+        }
+        if (type == 1)
+        {
+            uint8_t lengths[288 + 30];
+            int symbol = 0;
+            for (; symbol < 144; symbol++)
+                lengths[symbol] = 8;
+            for (; symbol < 256; symbol++)
+                lengths[symbol] = 9;
+            for (; symbol < 280; symbol++)
+                lengths[symbol] = 7;
+            for (; symbol < 288; symbol++)
+                lengths[symbol] = 8;
+            for (; symbol < 288 + 30; symbol++)
+                lengths[symbol] = 5;
+            construct(_memory->lengths, lengths, 288);
+            construct(_memory->distances, lengths + 288, 30);
+            _state = CODES;
+            return true;
+        }
+        if (type == 2)
+            return readDynamicTables();
+        return reject("invalid gzip data");
+    }
+
+    bool readDynamicTables()
+    {
+        static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        long nlen = bits(5);
+        long ndist = bits(5);
+        long ncode = bits(4);
+        if (nlen < 0 || ndist < 0 || ncode < 0)
+            return reject("gzip data incomplete");
+        nlen += 257;
+        ndist += 1;
+        ncode += 4;
+        if (nlen > 286 || ndist > 30)
+            return reject("invalid gzip data");
+
+        uint8_t lengths[286 + 30];
+        int index = 0;
+        for (; index < ncode; index++)
+        {
+            long len = bits(3);
+            if (len < 0)
+                return reject("gzip data incomplete");
+            lengths[order[index]] = (uint8_t)len;
+        }
+        for (; index < 19; index++)
+            lengths[order[index]] = 0;
+        // the code length code is decoded with the distance table, which is rebuilt below
+        if (construct(_memory->distances, lengths, 19) != 0)
+            return reject("invalid gzip data");
+
+        index = 0;
+        while (index < nlen + ndist)
+        {
+            int symbol = decode(_memory->distances);
+            if (symbol < 0)
+                return reject(symbol == -1 ? "gzip data incomplete" : "invalid gzip data");
+            if (symbol < 16)
+            {
+                lengths[index++] = (uint8_t)symbol;
+                continue;
+            }
+            uint8_t len = 0;
+            long repeat;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                    return reject("invalid gzip data");
+                len = lengths[index - 1];
+                repeat = bits(2);
+                repeat = repeat < 0 ? -1 : 3 + repeat;
+            }
+            else if (symbol == 17)
+            {
+                repeat = bits(3);
+                repeat = repeat < 0 ? -1 : 3 + repeat;
+            }
+            else
+            {
+                repeat = bits(7);
+                repeat = repeat < 0 ? -1 : 11 + repeat;
+            }
+            if (repeat < 0)
+                return reject("gzip data incomplete");
+            if (index + repeat > nlen + ndist)
+                return reject("invalid gzip data");
+            while (repeat--)
+                lengths[index++] = len;
+        }
+        if (lengths[256] == 0)
+            return reject("invalid gzip data");
+
+        // incomplete codes are only allowed for a single code
+        Huffman &lengthCode = _memory->lengths;
+        int err = construct(lengthCode, lengths, (int)nlen);
+        if (err && (err < 0 || nlen != lengthCode.count[0] + lengthCode.count[1]))
+            return reject("invalid gzip data");
+        Huffman &distanceCode = _memory->distances;
+        err = construct(distanceCode, lengths + nlen, (int)ndist);
+        if (err && (err < 0 || ndist != distanceCode.count[0] + distanceCode.count[1]))
+            return reject("invalid gzip data");
+        _state = CODES;
+        return true;
+    }
+
+    // length/distance pair for length symbol index 0..28
+    bool readCopy(int symbol)
+    {
+        static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                  193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                  6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                  6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        if (symbol >= 29)
+            return reject("invalid gzip data");
+        long extra = bits(lengthExtra[symbol]);
+        int distanceSymbol = extra < 0 ? -1 : decode(_memory->distances);
+        if (distanceSymbol < 0)
+            return reject(distanceSymbol == -1 ? "gzip data incomplete" : "invalid gzip data");
+        if (distanceSymbol >= 30)
+            return reject("invalid gzip data");
+        long distanceExtraBits = bits(distanceExtra[distanceSymbol]);
+        if (distanceExtraBits < 0)
+            return reject("gzip data incomplete");
+        uint32_t distance = distanceBase[distanceSymbol] + (uint32_t)distanceExtraBits;
+        if (distance > _filled)
+            return reject(distance > WINDOW ? "gzip window too small" : "invalid gzip data");
+        _copyLength = lengthBase[symbol] + (uint16_t)extra;
+        _distance = distance;
+        _state = COPY;
+        return true;
+    }
+
+    void readTrailer()
+    {
+        _bitBuffer = 0;
+        _bitCount = 0;
+        uint32_t crc, size;
+        if (!readLittleEndian(4, crc) || !readLittleEndian(4, size))
+            fail("gzip data incomplete");
+        else if (crc != _crc || size != _position)
+            fail("gzip checksum mismatch");
+        else
+            _state = DONE;
+    }
+
+    Memory *_memory; // window and tables, nullptr until allocate()
+    Stream *_source;
+    State _state;
+    const char *_error;
+    int _peek; // byte returned by peek(), -1 if none
+    uint32_t _bitBuffer;
+    int _bitCount;
+    uint32_t _position; // bytes decompressed (mod 2^32, as ISIZE in the trailer)
+    uint32_t _filled;   // bytes of history in the window
+    uint32_t _crc;
+    bool _lastBlock;
+    uint16_t _storedLength;
+    uint16_t _copyLength;
+    uint32_t _distance;
+};
+
+#endif // POSTGRESTINFLATE_H
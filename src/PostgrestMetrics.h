@@ -0,0 +1,102 @@
+#ifndef POSTGRESTMETRICS_H
+#define POSTGRESTMETRICS_H
+#include <Arduino.h>
+
+// per-request metrics of PostgrestClient; define as 0 to compile them out completely
+#ifndef POSTGREST_METRICS
+#define POSTGREST_METRICS 1
+#endif
+
+/**
+ * @brief Timing and traffic of one HTTP request of a PostgrestClient (data API or auth service),
+ * see PostgrestClient::onRequestMetrics().
+ * Phase times are microseconds since the request started; a phase that was not reached is 0.
+ */
+struct PostgrestRequestMetrics
+{
+    const char *verb;
+    const char *path;      // route or auth endpoint, without the API path
+    const char *error;     // nullptr on success; valid until the next request
+    int statusCode;        // 0 if no response was received
+    bool auth;             // request to the auth service (sign in, token renewal)
+    bool reused;           // sent on a kept-alive connection
+    bool tlsResumed;       // new connection with an abbreviated TLS handshake, see PostgrestClient::setTlsSessions()
+    bool tokenRefreshed;   // the token was renewed right before this data request
+    uint8_t retries;       // repeated after a closed kept-alive connection or by the retry policy
+    uint32_t connected;    // connection open: DNS, TCP and TLS handshake (of the last attempt)
+    uint32_t sent;         // request written to the connection
+    uint32_t firstByte;    // first response byte arrived: network round trip and server time
+    uint32_t headers;      // response head read
+    uint32_t done;         // body read and parsed: duration of the whole request
+    uint32_t bytesSent;    // request line, headers and body
+    uint32_t bytesReceived; // response head and body as received (compressed, with chunk framing)
+};
+
+/**
+ * @brief Callback receiving the metrics of every request, see PostgrestClient::onRequestMetrics()
+ * Called when the request is complete; must not send requests with the same client.
+ */
+typedef void (*PostgrestMetricsCallback)(const PostgrestRequestMetrics &metrics, void *context);
+
+/**
+ * @brief Counters over all requests since the last reset, see PostgrestClient::getMetricsTotals()
+ * The times are sums of the phases in microseconds; divide by requests for averages.
+ */
+struct PostgrestMetricsTotals
+{
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t retries;
+    uint32_t tokenRefreshes;
+    uint32_t reused;      // requests on a kept-alive connection
+    uint32_t tlsResumed;  // new connections that resumed a TLS session
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t connectTime; // up to connected
+    uint64_t sendTime;    // connected to sent
+    uint64_t waitTime;    // sent to first byte (or to the end of a request without response)
+    uint64_t headerTime;  // first byte to headers
+    uint64_t bodyTime;    // headers to done
+    uint32_t maxTime;     // longest request
+
+    void add(const PostgrestRequestMetrics &m)
+    {
+        requests++;
+        if (m.error)
+            failures++;
+        retries += m.retries;
+        if (m.tokenRefreshed)
+            tokenRefreshes++;
+        if (m.reused)
+            reused++;
+        if (m.tlsResumed)
+            tlsResumed++;
+        bytesSent += m.bytesSent;
+        bytesReceived += m.bytesReceived;
+        if (m.sent)
+        {
+            connectTime += m.connected;
+            sendTime += m.sent - m.connected;
+            waitTime += (m.firstByte ? m.firstByte : m.done) - m.sent;
+        }
+        else if (m.connected)
+        {
+            // sending failed
+            connectTime += m.connected;
+            sendTime += m.done - m.connected;
+        }
+        else
+        {
+            connectTime += m.done; // connecting failed
+        }
+        if (m.headers)
+        {
+            headerTime += m.headers - m.firstByte;
+            bodyTime += m.done - m.headers;
+        }
+        if (m.done > maxTime)
+            maxTime = m.done;
+    }
+};
+
+#endif // POSTGRESTMETRICS_H
@@ -0,0 +1,751 @@
+#ifndef POSTGRESTOFFLINEQUEUE_H
+#define POSTGRESTOFFLINEQUEUE_H
+#include "PostgrestClient.h"
+#include "PostgrestCrc32.h"
+
+#if defined(ESP32) || defined(ESP8266)
+#include <FS.h>
+#endif
+
+#ifndef POSTGREST_QUEUE_MAX_ROUTE
+#define POSTGREST_QUEUE_MAX_ROUTE 160
+#endif
+
+#ifndef POSTGREST_QUEUE_MAX_PATH
+#define POSTGREST_QUEUE_MAX_PATH 48
+#endif
+
+// compact the log when at least this many bytes at its start are acknowledged
+#ifndef POSTGREST_QUEUE_COMPACT_THRESHOLD
+#define POSTGREST_QUEUE_COMPACT_THRESHOLD 4096
+#endif
+
+/**
+ * @brief Append-only storage for the log of a PostgrestOfflineQueue.
+ * Implementations exist for Arduino file systems (LittleFS/SPIFFS on ESP32/ESP8266) and for
+ * POSIX files (host builds); implement this interface for other flash storage.
+ */
+class PostgrestQueueStorage
+{
+public:
+    virtual ~PostgrestQueueStorage() {}
+
+    /**
+     * @brief Restore a consistent log after a power loss during compact(). Called by begin().
+     */
+    virtual bool recover()
+    {
+        return true;
+    }
+
+    /**
+     * @brief Append header and payload (in this order) to the end of the log
+     */
+    virtual bool append(const uint8_t *header, size_t headerLength, const uint8_t *payload, size_t payloadLength) = 0;
+
+    /**
+     * @brief Read up to length bytes at offset
+     *
+     * @return size_t number of bytes read
+     */
+    virtual size_t read(uint32_t offset, uint8_t *data, size_t length) = 0;
+
+    // size of the log in bytes
+    virtual uint32_t size() = 0;
+
+    /**
+     * @brief Replace the log by its bytes [from, to). Must be atomic with respect to power loss
+     * (e.g. write a temporary file and rename it), an empty range empties the log.
+     */
+    virtual bool compact(uint32_t from, uint32_t to) = 0;
+};
+
+#if !defined(ARDUINO) || defined(POSTGREST_QUEUE_POSIX_STORAGE)
+/**
+ * @brief PostgrestQueueStorage in a POSIX file (stdio), e.g. for host builds and tests,
+ * or on Mbed with a mounted file system (define POSTGREST_QUEUE_POSIX_STORAGE).
+ */
+class PostgrestPosixQueueStorage : public PostgrestQueueStorage
+{
+public:
+    /**
+     * @param path path of the log file, path + ".tmp" is used during compaction
+     */
+    PostgrestPosixQueueStorage(const char *path)
+    {
+        snprintf(_path, sizeof(_path), "%s", path);
+        snprintf(_tmpPath, sizeof(_tmpPath), "%s.tmp", path);
+    }
+
+    bool append(const uint8_t *header, size_t headerLength, const uint8_t *payload, size_t payloadLength) override
+    {
+        FILE *f = fopen(_path, "ab");
+        if (!f)
+            return false;
+        bool ok = fwrite(header, 1, headerLength, f) == headerLength && fwrite(payload, 1, payloadLength, f) == payloadLength;
+        ok = fflush(f) == 0 && ok;
+        return fclose(f) == 0 && ok;
+    }
+
+    size_t read(uint32_t offset, uint8_t *data, size_t length) override
+    {
+        FILE *f = fopen(_path, "rb");
+        if (!f)
+            return 0;
+        size_t n = 0;
+        if (fseek(f, (long)offset, SEEK_SET) == 0)
+            n = fread(data, 1, length, f);
+        fclose(f);
+        return n;
+    }
+
+    uint32_t size() override
+    {
+        FILE *f = fopen(_path, "rb");
+        if (!f)
+            return 0;
+        long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : 0;
+        fclose(f);
+        return size > 0 ? (uint32_t)size : 0;
+    }
+
+    bool compact(uint32_t from, uint32_t to) override
+    {
+        FILE *out = fopen(_tmpPath, "wb");
+        if (!out)
+            return false;
+        uint8_t buf[64];
+        bool ok = true;
+        while (ok && from < to)
+        {
+            size_t n = to - from < sizeof(buf) ? to - from : sizeof(buf);
+            ok = read(from, buf, n) == n && fwrite(buf, 1, n, out) == n;
+            from += n;
+        }
+        ok = fclose(out) == 0 && ok;
+        if (!ok)
+        {
+            ::remove(_tmpPath);
+            return false;
+        }
+        return rename(_tmpPath, _path) == 0; // atomically replaces the log
+    }
+
+private:
+    char _path[POSTGREST_QUEUE_MAX_PATH];
+    char _tmpPath[POSTGREST_QUEUE_MAX_PATH + 4];
+};
+#endif
+
+#if defined(ESP32) || defined(ESP8266)
+/**
+ * @brief PostgrestQueueStorage in a file of an Arduino file system like LittleFS or SPIFFS.
+ * The file system must be mounted (e.g. LittleFS.begin()) before PostgrestOfflineQueue::begin().
+ */
+class PostgrestFsQueueStorage : public PostgrestQueueStorage
+{
+public:
+    /**
+     * @param fs file system, e.g. LittleFS
+     * @param path path of the log file like "/pgqueue.log", path + ".tmp" is used during compaction
+     */
+    PostgrestFsQueueStorage(fs::FS &fs, const char *path) : _fs(fs)
+    {
+        snprintf(_path, sizeof(_path), "%s", path);
+        snprintf(_tmpPath, sizeof(_tmpPath), "%s.tmp", path);
+    }
+
+    bool recover() override
+    {
+        // power loss between remove and rename in compact()
+        if (!_fs.exists(_path) && _fs.exists(_tmpPath))
+            return _fs.rename(_tmpPath, _path);
+        if (_fs.exists(_tmpPath))
+            _fs.remove(_tmpPath);
+        return true;
+    }
+
+    bool append(const uint8_t *header, size_t headerLength, const uint8_t *payload, size_t payloadLength) override
+    {
+        File f = _fs.open(_path, "a");
+        if (!f)
+            return false;
+        bool ok = f.write(header, headerLength) == headerLength && f.write(payload, payloadLength) == payloadLength;
+        f.close();
+        return ok;
+    }
+
+    size_t read(uint32_t offset, uint8_t *data, size_t length) override
+    {
+        File f = _fs.open(_path, "r");
+        if (!f)
+            return 0;
+        size_t n = 0;
+        if (f.seek(offset))
+            n = f.read(data, length);
+        f.close();
+        return n;
+    }
+
+    uint32_t size() override
+    {
+        File f = _fs.open(_path, "r");
+        if (!f)
+            return 0;
+        uint32_t size = f.size();
+        f.close();
+        return size;
+    }
+
+    bool compact(uint32_t from, uint32_t to) override
+    {
+        File out = _fs.open(_tmpPath, "w");
+        if (!out)
+            return false;
+        uint8_t buf[64];
+        bool ok = true;
+        while (ok && from < to)
+        {
+            size_t n = to - from < sizeof(buf) ? to - from : sizeof(buf);
+            ok = read(from, buf, n) == n && out.write(buf, n) == n;
+            from += n;
+        }
+        out.close();
+        if (!ok)
+        {
+            _fs.remove(_tmpPath);
+            return false;
+        }
+        // not every file system can rename onto an existing file, recover() handles a power loss in between
+        _fs.remove(_path);
+        return _fs.rename(_tmpPath, _path);
+    }
+
+private:
+    fs::FS &_fs;
+    char _path[POSTGREST_QUEUE_MAX_PATH];
+    char _tmpPath[POSTGREST_QUEUE_MAX_PATH + 4];
+};
+#endif
+
+/**
+ * @brief Callback reporting records the offline queue dropped because the database rejected them.
+ *
+ * @param error error message of the rejected request
+ * @param records number of dropped records
+ * @param context pointer passed to PostgrestOfflineQueue::onDrop()
+ */
+typedef void (*PostgrestQueueCallback)(const char *error, size_t records, void *context);
+
+/**
+ * @brief Durable store-and-forward queue for POST/PATCH/DELETE requests.
+ * Requests that cannot be sent because the data API is not reachable (connection failure,
+ * timeout, server error) are appended to a log in flash and replayed by poll() once the
+ * connection is back, so no samples are lost during hours without connectivity.
+ *
+ * The log is append-only and every record is framed with its lengths and a CRC-32, so a record
+ * torn by a power loss is detected and cut off by begin(). Acknowledged sends are recorded by
+ * small ack records; the acknowledged part is removed by compacting the log.
+ * poll() sends one request per call, merging consecutive POSTs to the same route into one JSON
+ * array (bulk insert) up to the size of the buffer, so the backlog drains at batch throughput.
+ * All memory is the caller supplied buffer, which limits the payload size of a single request.
+ *
+ * Usage:
+ *   PostgrestFsQueueStorage storage(LittleFS, "/pgqueue.log");
+ *   char queueBuffer[2048];
+ *   PostgrestOfflineQueue queue(pgClient, storage, queueBuffer, sizeof(queueBuffer));
+ *   queue.begin();                    // in setup(), after LittleFS.begin()
+ *   ...
+ *   JsonDocument &row = pgClient.getJsonRequest();
+ *   row["sensor_name"] = "temperature";
+ *   row["sensor_value"] = 21.5;
+ *   queue.submit("POST", "/sensorvalues"); // sent now or queued
+ *   queue.poll();                     // in loop(): replays the backlog
+ */
+class PostgrestOfflineQueue
+{
+public:
+    /**
+     * @param client signed in PostgrestClient used to send the requests
+     * @param storage storage of the log
+     * @param buffer memory for serializing payloads and merging queued POSTs
+     * @param bufferSize size of buffer, the maximum payload size of a request
+     */
+    PostgrestOfflineQueue(PostgrestClient &client, PostgrestQueueStorage &storage, char *buffer, size_t bufferSize)
+        : _client(client), _storage(storage), _buffer(buffer), _bufferSize(bufferSize), _head(0), _tail(0), _pending(0), _singleUntil(0),
+          _maxMergedRecords(100), _timeout(20000), _retryAt(0), _retryDelay(0), _maxRetryDelay(60000), _callback(nullptr), _context(nullptr), _lastError(nullptr)
+    {
+    }
+
+    /**
+     * @brief Open the log and find the requests still to be sent.
+     * A record torn by a power loss is cut off.
+     *
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *begin()
+    {
+        if (!_storage.recover())
+            return "cannot recover offline queue";
+        uint32_t size = _storage.size();
+        uint32_t pos = 0;
+        _head = 0;
+        Record record;
+        // find the end of the valid records and the last acknowledged offset
+        while (pos < size && readRecord(pos, record, nullptr, nullptr))
+        {
+            if (record.type == RECORD_ACK)
+                _head = record.ackedUntil;
+            pos += record.totalLength();
+        }
+        _tail = pos;
+        _pending = 0;
+        for (pos = _head; pos < _tail && readRecord(pos, record, nullptr, nullptr); pos += record.totalLength())
+        {
+            if (record.type != RECORD_ACK)
+                _pending++;
+        }
+        _singleUntil = 0;
+        if (_tail < size && !compact())
+            return "cannot truncate offline queue";
+        return nullptr;
+    }
+
+    /**
+     * @brief Send the payload in the client's getJsonRequest() now if possible, or queue it.
+     * Requests are queued if the backlog is not empty (to keep their order) or if sending fails
+     * with a transient error. getJsonRequest() is cleared, unless the request is refused because
+     * the verb is not supported or the route or payload does not fit in the queue.
+     *
+     * @param verb "POST", "PATCH" or "DELETE"; "UPSERT" or "UPSERT_IGNORE" to POST with
+     * resolution=merge-duplicates or ignore-duplicates (add "?on_conflict=..." to the route if needed)
+     * @param route route like "/sensorvalues" or "/sensorvalues?sensor_name=eq.temperature"
+     * @return const char* nullptr if the request was sent or queued, error message if it was
+     * rejected by the database or could not be queued
+     */
+    const char *submit(const char *verb, const char *route)
+    {
+        JsonDocument &request = _client.getJsonRequest();
+        size_t length = request.isNull() ? 0 : measureJson(request);
+        // refuse what enqueue() would refuse before the request is sent or cleared
+        const char *error = checkRequest(verb, route, length);
+        if (error)
+            return error;
+        if (length)
+            serializeJson(request, _buffer, _bufferSize);
+        request.clear();
+
+        uint8_t type = verbToType(verb);
+        if (_pending == 0 && !inRetryDelay())
+        {
+            error = sendRecord(type, route, _buffer, length);
+            if (!error || !_client.lastErrorIsTransient())
+                return error;
+            scheduleRetry(error);
+        }
+        return enqueue(verb, route, _buffer, length);
+    }
+
+    /**
+     * @brief Append a request with an already serialized payload to the queue without trying
+     * to send it first.
+     *
+     * @return const char* nullptr on success, error message in case of failure
+     */
+    const char *enqueue(const char *verb, const char *route, const char *json, size_t length)
+    {
+        const char *error = checkRequest(verb, route, length);
+        if (error)
+            return error;
+        uint8_t type = verbToType(verb);
+        size_t routeLength = strlen(route);
+
+        uint8_t header[HEADER_LENGTH + POSTGREST_QUEUE_MAX_ROUTE];
+        fillHeader(header, type, (const uint8_t *)route, routeLength, (const uint8_t *)json, length);
+        memcpy(header + HEADER_LENGTH, route, routeLength);
+        if (!_storage.append(header, HEADER_LENGTH + routeLength, (const uint8_t *)json, length))
+            return "cannot write offline queue";
+        _tail += HEADER_LENGTH + routeLength + length;
+        _pending++;
+        return nullptr;
+    }
+
+    /**
+     * @brief Replay queued requests, call regularly from loop().
+     * Sends at most one request per call; after a transient failure further sends are
+     * delayed with a growing retry delay. Rejected records are dropped and reported with onDrop().
+     *
+     * @return const char* nullptr if nothing had to be sent or the send succeeded, error message otherwise
+     */
+    const char *poll()
+    {
+        if (_pending == 0 || inRetryDelay())
+            return _pending ? _lastError : nullptr;
+
+        char route[POSTGREST_QUEUE_MAX_ROUTE + 1];
+        uint32_t pos = _head;
+        Record first;
+        // skip acks interleaved with the data records
+        while (pos < _tail && readRecord(pos, first, nullptr, nullptr) && first.type == RECORD_ACK)
+            pos += first.totalLength();
+        if (pos >= _tail || first.type == RECORD_ACK || !readRecord(pos, first, route, nullptr))
+            return corrupted();
+
+        size_t used = 0;
+        size_t records = 0;
+        uint32_t end = pos;
+        if (first.type != RECORD_PATCH && first.type != RECORD_DELETE && pos >= _singleUntil)
+        {
+            // merge consecutive POSTs (or upserts of the same kind) to the same route into one JSON array
+            _buffer[used++] = '[';
+            bool empty = true;
+            Record record;
+            while (end < _tail && records < _maxMergedRecords && readRecord(end, record, nullptr, nullptr))
+            {
+                if (record.type == RECORD_ACK)
+                {
+                    end += record.totalLength();
+                    continue;
+                }
+                if (record.type != first.type || record.routeLength != first.routeLength || used + 1 + record.bodyLength + 1 > _bufferSize)
+                    break;
+                char otherRoute[POSTGREST_QUEUE_MAX_ROUTE + 1];
+                size_t offset = empty ? used : used + 1;
+                if (!readRecord(end, record, otherRoute, _buffer + offset))
+                    return records ? sendMerged(first.type, route, used, records, end) : corrupted();
+                if (strcmp(otherRoute, route) != 0)
+                    break;
+                size_t length = record.bodyLength;
+                const char *body = _buffer + offset;
+                if (length >= 2 && body[0] == '[' && body[length - 1] == ']')
+                {
+                    // array payload: append its elements
+                    memmove(_buffer + offset, body + 1, length - 2);
+                    length -= 2;
+                }
+                if (length > 0)
+                {
+                    if (!empty)
+                        _buffer[used] = ',';
+                    used = offset + length;
+                    empty = false;
+                }
+                records++;
+                end += record.totalLength();
+            }
+            if (records > 0)
+                return sendMerged(first.type, route, used, records, end);
+        }
+
+        // single PATCH, DELETE, POST or upsert
+        if (first.bodyLength > _bufferSize || !readRecord(pos, first, route, _buffer))
+            return corrupted();
+        const char *error = sendRecord(first.type, route, _buffer, first.bodyLength);
+        return finishSend(error, 1, pos + first.totalLength());
+    }
+
+    // true if no requests are waiting to be sent
+    bool isEmpty() const
+    {
+        return _pending == 0;
+    }
+
+    // number of requests waiting to be sent
+    size_t pendingRecords() const
+    {
+        return _pending;
+    }
+
+    // bytes of the log that are not acknowledged yet
+    uint32_t pendingBytes() const
+    {
+        return _tail - _head;
+    }
+
+    // error of the last failed send, nullptr if the last send succeeded
+    const char *getLastError() const
+    {
+        return _lastError;
+    }
+
+    /**
+     * @brief Register a callback for records that are dropped because the database rejected them
+     */
+    void onDrop(PostgrestQueueCallback callback, void *context = nullptr)
+    {
+        _callback = callback;
+        _context = context;
+    }
+
+    /**
+     * @brief Limit the number of queued POSTs merged into one request (default 100)
+     */
+    void setMaxMergedRecords(size_t records)
+    {
+        _maxMergedRecords = records ? records : 1;
+    }
+
+    /**
+     * @brief Set the maximum delay between retries after transient failures (default 60 s)
+     */
+    void setMaxRetryDelay(unsigned long maxRetryDelay)
+    {
+        _maxRetryDelay = maxRetryDelay;
+    }
+
+    void setTimeout(unsigned long timeout)
+    {
+        _timeout = timeout;
+    }
+
+private:
+    // record layout: magic, type, route length (2), body length (2), crc (4), route, body
+    static const uint8_t MAGIC = 0xA5;
+    static const size_t HEADER_LENGTH = 10;
+    static const uint8_t RECORD_POST = 'P';
+    static const uint8_t RECORD_PATCH = 'U';
+    static const uint8_t RECORD_DELETE = 'D';
+    static const uint8_t RECORD_UPSERT = 'M';        // POST with resolution=merge-duplicates
+    static const uint8_t RECORD_UPSERT_IGNORE = 'I'; // POST with resolution=ignore-duplicates
+    static const uint8_t RECORD_ACK = 'K'; // body: 4 byte distance back to the acknowledged offset
+
+    struct Record
+    {
+        uint8_t type;
+        uint16_t routeLength;
+        uint16_t bodyLength;
+        uint32_t ackedUntil; // RECORD_ACK only: absolute offset up to which records are acknowledged
+
+        uint32_t totalLength() const
+        {
+            return HEADER_LENGTH + routeLength + bodyLength;
+        }
+    };
+
+    static uint8_t verbToType(const char *verb)
+    {
+        if (strcmp(verb, "POST") == 0)
+            return RECORD_POST;
+        if (strcmp(verb, "PATCH") == 0)
+            return RECORD_PATCH;
+        if (strcmp(verb, "DELETE") == 0)
+            return RECORD_DELETE;
+        if (strcmp(verb, "UPSERT") == 0)
+            return RECORD_UPSERT;
+        if (strcmp(verb, "UPSERT_IGNORE") == 0)
+            return RECORD_UPSERT_IGNORE;
+        return 0;
+    }
+
+    // nullptr if a request can be queued: known verb, route and payload fit in a record and the buffer
+    const char *checkRequest(const char *verb, const char *route, size_t length) const
+    {
+        if (!verbToType(verb))
+            return "unsupported verb for offline queue";
+        if (strlen(route) > POSTGREST_QUEUE_MAX_ROUTE)
+            return "route too long for offline queue";
+        if (length > 0xFFFF || length + 2 > _bufferSize)
+            return "payload too large for offline queue";
+        return nullptr;
+    }
+
+    // send the payload of a record of the given type
+    const char *sendRecord(uint8_t type, const char *route, const char *json, size_t length)
+    {
+        if (type == RECORD_PATCH)
+            return _client.doSendJson("PATCH", route, json, length, _timeout);
+        if (type == RECORD_DELETE)
+            return _client.doSendJson("DELETE", route, json, length, _timeout);
+        if (type == RECORD_POST)
+            return _client.doSendJson("POST", route, json, length, _timeout);
+        PostgrestRequestOptions upsert(nullptr, nullptr, false, type == RECORD_UPSERT ? "merge-duplicates" : "ignore-duplicates");
+        return _client.doSendJson("POST", route, json, length, _timeout, &upsert);
+    }
+
+    // fill the fixed part of a record header (the route follows it)
+    static void fillHeader(uint8_t *header, uint8_t type, const uint8_t *route, size_t routeLength, const uint8_t *body, size_t bodyLength)
+    {
+        header[0] = MAGIC;
+        header[1] = type;
+        header[2] = (uint8_t)routeLength;
+        header[3] = (uint8_t)(routeLength >> 8);
+        header[4] = (uint8_t)bodyLength;
+        header[5] = (uint8_t)(bodyLength >> 8);
+        uint32_t crc = postgrest_crc32(0, header + 1, 5);
+        crc = postgrest_crc32(crc, route, routeLength);
+        crc = postgrest_crc32(crc, body, bodyLength);
+        for (int i = 0; i < 4; i++)
+            header[6 + i] = (uint8_t)(crc >> (8 * i));
+    }
+
+    /**
+     * @brief Read and verify the record at pos.
+     * route (POSTGREST_QUEUE_MAX_ROUTE + 1 bytes) and body (bodyLength bytes) receive the
+     * record's contents if not nullptr; otherwise they are read in pieces only to check the crc.
+     */
+    bool readRecord(uint32_t pos, Record &record, char *route, char *body)
+    {
+        uint8_t header[HEADER_LENGTH];
+        if (_storage.read(pos, header, HEADER_LENGTH) != HEADER_LENGTH || header[0] != MAGIC)
+            return false;
+        record.type = header[1];
+        record.routeLength = (uint16_t)(header[2] | (header[3] << 8));
+        record.bodyLength = (uint16_t)(header[4] | (header[5] << 8));
+        record.ackedUntil = 0;
+        uint32_t crc = 0;
+        for (int i = 0; i < 4; i++)
+            crc |= (uint32_t)header[6 + i] << (8 * i);
+        if (record.routeLength > POSTGREST_QUEUE_MAX_ROUTE)
+            return false;
+
+        uint32_t check = postgrest_crc32(0, header + 1, 5);
+        uint32_t offset = pos + HEADER_LENGTH;
+        char routeScratch[POSTGREST_QUEUE_MAX_ROUTE + 1];
+        char *r = route ? route : routeScratch;
+        if (_storage.read(offset, (uint8_t *)r, record.routeLength) != record.routeLength)
+            return false;
+        r[record.routeLength] = '\0';
+        check = postgrest_crc32(check, (const uint8_t *)r, record.routeLength);
+        offset += record.routeLength;
+
+        if (body)
+        {
+            if (_storage.read(offset, (uint8_t *)body, record.bodyLength) != record.bodyLength)
+                return false;
+            check = postgrest_crc32(check, (const uint8_t *)body, record.bodyLength);
+            if (record.type == RECORD_ACK && record.bodyLength == 4)
+                record.ackedUntil = decodeAck(pos, (const uint8_t *)body);
+        }
+        else
+        {
+            uint8_t buf[32];
+            uint8_t first4[4] = {0, 0, 0, 0};
+            for (uint16_t done = 0; done < record.bodyLength;)
+            {
+                size_t n = (size_t)(record.bodyLength - done) < sizeof(buf) ? (size_t)(record.bodyLength - done) : sizeof(buf);
+                if (_storage.read(offset + done, buf, n) != n)
+                    return false;
+                if (done == 0)
+                    memcpy(first4, buf, n < 4 ? n : 4);
+                check = postgrest_crc32(check, buf, n);
+                done += n;
+            }
+            if (record.type == RECORD_ACK && record.bodyLength == 4)
+                record.ackedUntil = decodeAck(pos, first4);
+        }
+        return check == crc;
+    }
+
+    static uint32_t decodeAck(uint32_t pos, const uint8_t *body)
+    {
+        uint32_t distance = (uint32_t)body[0] | ((uint32_t)body[1] << 8) | ((uint32_t)body[2] << 16) | ((uint32_t)body[3] << 24);
+        // after compaction the acknowledged offset may lie before the start of the log
+        return distance > pos ? 0 : pos - distance;
+    }
+
+    const char *sendMerged(uint8_t type, const char *route, size_t used, size_t records, uint32_t end)
+    {
+        _buffer[used++] = ']';
+        const char *error = sendRecord(type, route, _buffer, used);
+        if (error && records > 1 && !_client.lastErrorIsTransient())
+        {
+            // find the rejected records by sending the merged ones one at a time
+            _singleUntil = end;
+            _lastError = error;
+            return error;
+        }
+        return finishSend(error, records, end);
+    }
+
+    const char *finishSend(const char *error, size_t records, uint32_t end)
+    {
+        if (error && _client.lastErrorIsTransient())
+        {
+            scheduleRetry(error);
+            return error;
+        }
+        if (error && _callback)
+            _callback(error, records, _context);
+        _retryDelay = 0;
+        _lastError = error;
+        acknowledge(end, records);
+        return error;
+    }
+
+    // record that everything before end is sent
+    void acknowledge(uint32_t end, size_t records)
+    {
+        _pending = records < _pending ? _pending - records : 0;
+        _head = _pending ? end : _tail; // only acks are left after the last data record
+        if (_pending == 0 || (_head >= POSTGREST_QUEUE_COMPACT_THRESHOLD && _head > _tail - _head))
+        {
+            if (compact())
+                return;
+        }
+        uint8_t header[HEADER_LENGTH];
+        uint8_t body[4];
+        uint32_t distance = _tail - _head;
+        for (int i = 0; i < 4; i++)
+            body[i] = (uint8_t)(distance >> (8 * i));
+        fillHeader(header, RECORD_ACK, nullptr, 0, body, sizeof(body));
+        if (_storage.append(header, HEADER_LENGTH, body, sizeof(body)))
+            _tail += HEADER_LENGTH + sizeof(body);
+    }
+
+    // drop the acknowledged start (and a torn end) of the log
+    bool compact()
+    {
+        if (!_storage.compact(_head, _tail))
+            return false;
+        _singleUntil = _singleUntil > _head ? _singleUntil - _head : 0;
+        _tail -= _head;
+        _head = 0;
+        return true;
+    }
+
+    // the log cannot be read at the head: drop the unreadable rest
+    const char *corrupted()
+    {
+        _tail = _head;
+        _pending = 0;
+        compact();
+        _lastError = "offline queue corrupted";
+        return _lastError;
+    }
+
+    bool inRetryDelay() const
+    {
+        return _retryDelay && (long)(millis() - _retryAt) < 0;
+    }
+
+    void scheduleRetry(const char *error)
+    {
+        _lastError = error;
+        if (_retryDelay == 0)
+            _retryDelay = 1000;
+        else if (_retryDelay < _maxRetryDelay)
+            _retryDelay *= 2;
+        if (_retryDelay > _maxRetryDelay)
+            _retryDelay = _maxRetryDelay;
+        _retryAt = millis() + _retryDelay;
+    }
+
+    PostgrestClient &_client;
+    PostgrestQueueStorage &_storage;
+    char *_buffer;
+    size_t _bufferSize;
+    uint32_t _head;        // offset of the first record not acknowledged yet
+    uint32_t _tail;        // end of the last valid record
+    size_t _pending;       // data records between _head and _tail
+    uint32_t _singleUntil; // records before this offset are replayed one at a time (after a rejected merge)
+    size_t _maxMergedRecords;
+    unsigned long _timeout;
+    unsigned long _retryAt;
+    unsigned long _retryDelay;
+    unsigned long _maxRetryDelay;
+    PostgrestQueueCallback _callback;
+    void *_context;
+    const char *_lastError;
+};
+
+#endif // POSTGRESTOFFLINEQUEUE_H
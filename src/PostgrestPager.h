@@ -0,0 +1,132 @@
+#ifndef POSTGRESTPAGER_H
+#define POSTGRESTPAGER_H
+#include "PostgrestClient.h"
+
+/**
+ * @brief Fetches a large table page by page with PostgrestClient::doGetPage(), so only one page
+ * of rows is in memory at a time.
+ * The offset only advances to the next page when next() is called again after a successful page,
+ * so after an error next() fetches the same page again. getOffset()/begin(offset) allow to
+ * continue a sync after a restart.
+ *
+ * Usage:
+ *   PostgrestPager pager(pgClient, "/lookup?order=id", 50);
+ *   while (pager.next())
+ *   {
+ *       JsonArray rows = pgClient.getJsonResult().as<JsonArray>();
+ *       ... // process the page
+ *   }
+ *   if (pager.getError())
+ *       ... // call pager.next() later to continue with the failed page
+ */
+class PostgrestPager
+{
+public:
+    /**
+     * @param client signed in PostgrestClient
+     * @param route route of the rows, should contain "order=" so pages don't overlap
+     * @param pageSize rows per page
+     */
+    PostgrestPager(PostgrestClient &client, const char *route, unsigned long pageSize)
+        : _client(client), _route(route), _pageSize(pageSize), _count(nullptr), _timeout(20000),
+          _offset(0), _pageRows(0), _total(-1), _done(false), _error(nullptr) {}
+
+    /**
+     * @brief Have the server count all rows with the first page, see getTotal()
+     *
+     * @param count "exact", "planned" or "estimated", nullptr to not count
+     */
+    void setCount(const char *count)
+    {
+        _count = count;
+    }
+
+    void setTimeout(unsigned long timeout)
+    {
+        _timeout = timeout;
+    }
+
+    /**
+     * @brief Start again (or continue a previous sync) at the given row
+     */
+    void begin(unsigned long offset = 0)
+    {
+        _offset = offset;
+        _pageRows = 0;
+        _done = false;
+        _error = nullptr;
+    }
+
+    /**
+     * @brief Fetch the next page into getJsonResult(). The page returned by the previous call
+     * counts as processed.
+     *
+     * @return true a page with at least one row is in getJsonResult()
+     * @return false all rows were fetched, or an error occurred (see getError())
+     */
+    bool next()
+    {
+        _offset += _pageRows;
+        _pageRows = 0;
+        if (_done)
+            return false;
+
+        // count only once: estimating or counting the table again for every page is wasted work
+        _error = _client.doGetPage(_route, _offset, _pageSize, _total < 0 ? _count : nullptr, _timeout);
+        if (_error)
+        {
+            if (_client.getLastStatusCode() == 416) // offset beyond the last row
+            {
+                _error = nullptr;
+                _done = true;
+            }
+            return false;
+        }
+        if (_client.getContentRangeTotal() >= 0)
+            _total = _client.getContentRangeTotal();
+
+        JsonDocument &page = _client.getJsonResult();
+        _pageRows = page.is<JsonArray>() ? page.size() : 0;
+        if (_pageRows < _pageSize || (_total >= 0 && _offset + _pageRows >= (unsigned long)_total))
+            _done = true;
+        return _pageRows > 0;
+    }
+
+    // true when all rows were fetched
+    bool done() const
+    {
+        return _done;
+    }
+
+    // error of the last next(), nullptr if none
+    const char *getError() const
+    {
+        return _error;
+    }
+
+    // index of the first row not yet processed, to resume with begin() after a restart
+    unsigned long getOffset() const
+    {
+        return _offset;
+    }
+
+    // total number of rows reported by the server, -1 if not counted (see setCount())
+    long getTotal() const
+    {
+        return _total;
+    }
+
+private:
+    PostgrestClient &_client;
+    const char *_route;
+    unsigned long _pageSize;
+    const char *_count;
+    unsigned long _timeout;
+    unsigned long _offset;   // first row of the current page
+    unsigned long _pageRows; // rows of the current page, added to _offset by the next call
+    long _total;
+    bool _done;
+    const char *_error;
+};
+
+#endif // POSTGRESTPAGER_H
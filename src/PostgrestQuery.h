@@ -0,0 +1,317 @@
+#ifndef POSTGRESTQUERY_H
+#define POSTGRESTQUERY_H
+#include <Arduino.h>
+#include "PostgrestWriteBuffer.h"
+
+/**
+ * @brief Builds a PostgREST route like "/people?select=name,age&age=lt.13&order=age.desc"
+ * without String concatenation or heap allocations.
+ * The route is written straight to a Print: a fixed buffer (PostgrestRoute) or any other output.
+ * Table, column, select and operator arguments are constants of the sketch and are written as
+ * they are; values are percent-encoded, so they can contain spaces, '&', '#' or non-ASCII text.
+ *
+ * Usage:
+ *   PostgrestRoute<128> route("/sensorvalues");
+ *   route.select("sensor_name,avg(sensor_value)").eq("sensor_name", name).gte("created_at", since).limit(10);
+ *   if (route.ok())
+ *       pgClient.doGet(route.c_str());
+ */
+class PostgrestQuery
+{
+public:
+    /**
+     * @param out where the route is written
+     * @param table table, view or "/rpc/function" path with leading '/'
+     */
+    PostgrestQuery(Print &out, const char *table) : _out(out), _params(false), _last(NONE), _digits(2)
+    {
+        _out.print(table);
+    }
+
+    /**
+     * @brief Columns to return, including aggregates ("avg(temperature)"), renames
+     * ("temp:temperature") and embedded resources ("name,sensors(location)")
+     */
+    PostgrestQuery &select(const char *columns)
+    {
+        param("select");
+        _out.print(columns);
+        return *this;
+    }
+
+    // column = value
+    template <typename T>
+    PostgrestQuery &eq(const char *column, T value)
+    {
+        return filter(column, "eq", value);
+    }
+
+    // column <> value
+    template <typename T>
+    PostgrestQuery &neq(const char *column, T value)
+    {
+        return filter(column, "neq", value);
+    }
+
+    // column < value
+    template <typename T>
+    PostgrestQuery &lt(const char *column, T value)
+    {
+        return filter(column, "lt", value);
+    }
+
+    // column <= value
+    template <typename T>
+    PostgrestQuery &lte(const char *column, T value)
+    {
+        return filter(column, "lte", value);
+    }
+
+    // column > value
+    template <typename T>
+    PostgrestQuery &gt(const char *column, T value)
+    {
+        return filter(column, "gt", value);
+    }
+
+    // column >= value
+    template <typename T>
+    PostgrestQuery &gte(const char *column, T value)
+    {
+        return filter(column, "gte", value);
+    }
+
+    // LIKE pattern, use '*' as wildcard
+    PostgrestQuery &like(const char *column, const char *pattern)
+    {
+        return filter(column, "like", pattern);
+    }
+
+    // IS null, true, false or unknown
+    PostgrestQuery &is(const char *column, const char *value)
+    {
+        return filter(column, "is", value);
+    }
+
+    /**
+     * @brief Any PostgREST operator, e.g. filter("tags", "cs", "{urgent}") or
+     * filter("sensors.location", "eq", "kitchen") for an embedded resource
+     */
+    template <typename T>
+    PostgrestQuery &filter(const char *column, const char *op, T value)
+    {
+        param(column);
+        _out.print(op);
+        _out.print('.');
+        printValue(value);
+        return *this;
+    }
+
+    /**
+     * @brief column IN (values...). Text values are quoted, so they may contain commas.
+     */
+    template <typename T>
+    PostgrestQuery &in(const char *column, const T *values, size_t count)
+    {
+        param(column);
+        _out.print("in.(");
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i > 0)
+                _out.print(',');
+            printListValue(values[i]);
+        }
+        _out.print(')');
+        return *this;
+    }
+
+    /**
+     * @brief Sort by column; call again right after to add further sort columns
+     */
+    PostgrestQuery &order(const char *column, bool ascending = true)
+    {
+        if (_last == ORDER)
+            _out.print(',');
+        else
+            param("order");
+        _out.print(column);
+        _out.print(ascending ? ".asc" : ".desc");
+        _last = ORDER;
+        return *this;
+    }
+
+    PostgrestQuery &limit(unsigned long rows)
+    {
+        param("limit");
+        _out.print(rows);
+        return *this;
+    }
+
+    PostgrestQuery &offset(unsigned long rows)
+    {
+        param("offset");
+        _out.print(rows);
+        return *this;
+    }
+
+    // number of decimals written for float and double values, default 2
+    PostgrestQuery &precision(int digits)
+    {
+        _digits = digits;
+        return *this;
+    }
+
+protected:
+    enum Param
+    {
+        NONE,
+        OTHER,
+        ORDER
+    };
+
+    // start the next query parameter "name="
+    void param(const char *name)
+    {
+        _out.print(_params ? '&' : '?');
+        _params = true;
+        _out.print(name);
+        _out.print('=');
+        _last = OTHER;
+    }
+
+    void printValue(const char *value)
+    {
+        printEncoded(value, false);
+    }
+
+    void printValue(const String &value)
+    {
+        printEncoded(value.c_str(), false);
+    }
+
+    void printValue(bool value)
+    {
+        _out.print(value ? "true" : "false");
+    }
+
+    void printValue(float value)
+    {
+        _out.print(value, _digits);
+    }
+
+    void printValue(double value)
+    {
+        _out.print(value, _digits);
+    }
+
+    void printValue(int value)
+    {
+        _out.print(value);
+    }
+
+    void printValue(unsigned int value)
+    {
+        _out.print(value);
+    }
+
+    void printValue(long value)
+    {
+        _out.print(value);
+    }
+
+    void printValue(unsigned long value)
+    {
+        _out.print(value);
+    }
+
+    // numbers are written as they are, text is quoted for the list syntax
+    template <typename T>
+    void printListValue(T value)
+    {
+        printValue(value);
+    }
+
+    void printListValue(const char *value)
+    {
+        printEncoded(value, true);
+    }
+
+    void printListValue(const String &value)
+    {
+        printEncoded(value.c_str(), true);
+    }
+
+    /**
+     * @brief Write text percent-encoded: everything except unreserved characters (RFC 3986).
+     * quoted adds the double quotes and backslash escapes of PostgREST's list syntax.
+     */
+    void printEncoded(const char *text, bool quoted)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        if (quoted)
+            _out.print("%22");
+        for (const char *p = text ? text : ""; *p; p++)
+        {
+            unsigned char c = (unsigned char)*p;
+            if (quoted && (c == '"' || c == '\\'))
+                _out.print("%5C");
+            if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+            {
+                _out.print((char)c);
+            }
+            else
+            {
+                char escape[3] = {'%', hex[c >> 4], hex[c & 0x0f]};
+                _out.write((const uint8_t *)escape, 3);
+            }
+        }
+        if (quoted)
+            _out.print("%22");
+    }
+
+    Print &_out;
+    bool _params; // '?' written
+    Param _last;  // parameter written last, to continue an order list
+    int _digits;
+};
+
+// holds the route buffer of a PostgrestRoute; a base class so it exists before PostgrestQuery writes to it
+template <size_t Size>
+class PostgrestRouteBuffer
+{
+protected:
+    PostgrestRouteBuffer() : _print(_buffer, Size) {}
+
+    char _buffer[Size];
+    PostgrestCharPrint _print;
+};
+
+/**
+ * @brief PostgrestQuery into a fixed buffer of Size bytes, typically a local variable.
+ * Pass c_str() to doGet(), doPatch(), doDelete(), ... after checking ok().
+ */
+template <size_t Size>
+class PostgrestRoute : private PostgrestRouteBuffer<Size>, public PostgrestQuery
+{
+public:
+    explicit PostgrestRoute(const char *table) : PostgrestRouteBuffer<Size>(), PostgrestQuery(this->_print, table) {}
+
+    const char *c_str() const
+    {
+        return this->_buffer;
+    }
+
+    // length of the complete route, larger than Size - 1 if it was truncated
+    size_t length() const
+    {
+        return this->_print.length();
+    }
+
+    // false if the route did not fit into the buffer
+    bool ok() const
+    {
+        return this->_print.length() < Size;
+    }
+};
+
+#endif // POSTGRESTQUERY_H
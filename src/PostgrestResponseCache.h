@@ -0,0 +1,356 @@
+#ifndef POSTGRESTRESPONSECACHE_H
+#define POSTGRESTRESPONSECACHE_H
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <stdlib.h>
+#include <string.h>
+
+// number of responses a PostgrestResponseCache holds at most
+#ifndef POSTGREST_CACHE_ENTRIES
+#define POSTGREST_CACHE_ENTRIES 8
+#endif
+
+// number of route prefixes that can be registered with PostgrestResponseCache::cacheRoute()
+#ifndef POSTGREST_CACHE_RULES
+#define POSTGREST_CACHE_RULES 8
+#endif
+
+/**
+ * @brief ArduinoJson allocator on the heap that counts the bytes it hands out and refuses
+ * allocations beyond a budget. Used by PostgrestResponseCache for the cached documents.
+ */
+class PostgrestBudgetAllocator : public ArduinoJson::Allocator
+{
+public:
+    explicit PostgrestBudgetAllocator(size_t budget) : _budget(budget), _used(0) {}
+
+    virtual ~PostgrestBudgetAllocator() {}
+
+    void *allocate(size_t size) override
+    {
+        if (!fits(0, size))
+            return nullptr;
+        Header *block = (Header *)malloc(HEADER + size);
+        if (!block)
+            return nullptr;
+        block->size = size;
+        _used += HEADER + size;
+        return (uint8_t *)block + HEADER;
+    }
+
+    void deallocate(void *ptr) override
+    {
+        if (!ptr)
+            return;
+        Header *block = header(ptr);
+        _used -= HEADER + block->size;
+        free(block);
+    }
+
+    void *reallocate(void *ptr, size_t new_size) override
+    {
+        if (!ptr)
+            return allocate(new_size);
+        Header *block = header(ptr);
+        size_t old_size = block->size;
+        if (!fits(old_size, new_size))
+            return nullptr;
+        block = (Header *)realloc(block, HEADER + new_size);
+        if (!block)
+            return nullptr;
+        block->size = new_size;
+        _used = _used - old_size + new_size;
+        return (uint8_t *)block + HEADER;
+    }
+
+    // heap bytes in use, including the size headers
+    size_t used() const
+    {
+        return _used;
+    }
+
+    size_t budget() const
+    {
+        return _budget;
+    }
+
+private:
+    struct Header
+    {
+        size_t size;
+    };
+
+    // keeps the blocks 8 byte aligned like malloc()
+    static const size_t HEADER = sizeof(Header) > 8 ? sizeof(Header) : 8;
+
+    static Header *header(void *ptr)
+    {
+        return (Header *)((uint8_t *)ptr - HEADER);
+    }
+
+    // true if a block of old_size bytes can grow to new_size bytes within the budget
+    bool fits(size_t old_size, size_t new_size) const
+    {
+        size_t need = old_size ? new_size : HEADER + new_size;
+        if (need < new_size)
+            return false;
+        return _used - old_size + need <= _budget;
+    }
+
+    size_t _budget;
+    size_t _used;
+};
+
+/**
+ * @brief Keeps the results of doGet() for routes whose data rarely changes (configuration,
+ * calibration tables, thresholds), see PostgrestClient::setResponseCache().
+ * Only routes registered with cacheRoute() are cached, each for its own time to live. A hit
+ * copies the cached document into getJsonResult() without a request and without parsing.
+ * All cached documents share a memory budget; when a new result does not fit, the least
+ * recently used ones are dropped. Writes through the same client (doPost, doPatch, doDelete,
+ * doUpsert, ...) drop the cached results of the table they write to.
+ *
+ * Usage:
+ *   PostgrestResponseCache cache(8192);         // bytes of heap for cached results
+ *   cache.cacheRoute("/settings", 600000UL);    // every route starting with "/settings", 10 minutes
+ *   cache.cacheRoute("/thresholds", 60000UL);
+ *   pgClient.setResponseCache(&cache);
+ */
+class PostgrestResponseCache
+{
+public:
+    /**
+     * @param budget bytes of heap the cached results (and their routes) may take together
+     */
+    explicit PostgrestResponseCache(size_t budget)
+        : _allocator(budget), _ruleCount(0), _clock(0), _hits(0), _misses(0), _evictions(0)
+    {
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+        {
+            _entries[i].route = nullptr;
+            _entries[i].document = JsonDocument(&_allocator);
+        }
+    }
+
+    ~PostgrestResponseCache()
+    {
+        clear();
+    }
+
+    PostgrestResponseCache(const PostgrestResponseCache &) = delete;
+    PostgrestResponseCache &operator=(const PostgrestResponseCache &) = delete;
+
+    /**
+     * @brief Cache the results of routes starting with prefix.
+     * Rules are checked in the order they were added; the first matching one applies.
+     *
+     * @param prefix route prefix like "/settings" or "/settings?device=eq.7"; must stay valid
+     * @param ttl milliseconds a result is served from the cache
+     * @return false if POSTGREST_CACHE_RULES rules exist already
+     */
+    bool cacheRoute(const char *prefix, unsigned long ttl)
+    {
+        if (_ruleCount == POSTGREST_CACHE_RULES)
+            return false;
+        _rules[_ruleCount].prefix = prefix;
+        _rules[_ruleCount].ttl = ttl;
+        _ruleCount++;
+        return true;
+    }
+
+    /**
+     * @brief Copy the cached result of route into result
+     *
+     * @return true on a hit, false if route is not cached or its result expired
+     */
+    bool lookup(const char *route, JsonDocument &result)
+    {
+        const Rule *rule = ruleFor(route);
+        if (!rule)
+            return false;
+        Entry *entry = find(route);
+        if (!entry || millis() - entry->storedAt >= rule->ttl || !result.set(entry->document))
+        {
+            _misses++;
+            return false;
+        }
+        entry->lastUsed = ++_clock;
+        _hits++;
+        return true;
+    }
+
+    /**
+     * @brief Keep a copy of the result of route, if route is cached and the result fits
+     *
+     * @return true if the result was stored
+     */
+    bool store(const char *route, const JsonDocument &result)
+    {
+        if (!ruleFor(route))
+            return false;
+        Entry *entry = find(route);
+        if (entry)
+            release(entry);
+        else
+            entry = unusedEntry();
+        while (!fill(entry, route, result))
+        {
+            release(entry);
+            Entry *victim = leastRecentlyUsed();
+            if (!victim)
+                return false; // larger than the whole budget
+            release(victim);
+            _evictions++;
+        }
+        entry->storedAt = millis();
+        entry->lastUsed = ++_clock;
+        return true;
+    }
+
+    /**
+     * @brief Drop the cached results of a table, e.g. after it was changed by other means
+     *
+     * @param route table like "/settings", or any route of it (the query is ignored)
+     */
+    void invalidate(const char *route)
+    {
+        size_t length = tableLength(route);
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+        {
+            Entry &entry = _entries[i];
+            if (entry.route && tableLength(entry.route) == length && strncmp(entry.route, route, length) == 0)
+                release(&entry);
+        }
+    }
+
+    // drop all cached results
+    void clear()
+    {
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+            release(&_entries[i]);
+    }
+
+    // lookups served from the cache
+    uint32_t hits() const
+    {
+        return _hits;
+    }
+
+    // lookups of cached routes that had to be requested
+    uint32_t misses() const
+    {
+        return _misses;
+    }
+
+    // results dropped to make room for others
+    uint32_t evictions() const
+    {
+        return _evictions;
+    }
+
+    // heap bytes taken by the cached results
+    size_t used() const
+    {
+        return _allocator.used();
+    }
+
+private:
+    struct Rule
+    {
+        const char *prefix;
+        unsigned long ttl;
+    };
+
+    struct Entry
+    {
+        char *route; // copy of the route, nullptr if unused
+        JsonDocument document;
+        unsigned long storedAt; // millis()
+        uint32_t lastUsed;      // _clock at the last store or hit
+    };
+
+    // length of the table part of a route: up to the query
+    static size_t tableLength(const char *route)
+    {
+        const char *query = strchr(route, '?');
+        return query ? (size_t)(query - route) : strlen(route);
+    }
+
+    const Rule *ruleFor(const char *route) const
+    {
+        for (size_t i = 0; i < _ruleCount; i++)
+        {
+            if (strncmp(route, _rules[i].prefix, strlen(_rules[i].prefix)) == 0)
+                return &_rules[i];
+        }
+        return nullptr;
+    }
+
+    Entry *find(const char *route)
+    {
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+        {
+            if (_entries[i].route && strcmp(_entries[i].route, route) == 0)
+                return &_entries[i];
+        }
+        return nullptr;
+    }
+
+    // a free entry, otherwise the least recently used one (released)
+    Entry *unusedEntry()
+    {
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+        {
+            if (!_entries[i].route)
+                return &_entries[i];
+        }
+        Entry *victim = leastRecentlyUsed();
+        release(victim);
+        _evictions++;
+        return victim;
+    }
+
+    // the used entry that was not used for the longest time, nullptr if all are free
+    Entry *leastRecentlyUsed()
+    {
+        Entry *oldest = nullptr;
+        for (size_t i = 0; i < POSTGREST_CACHE_ENTRIES; i++)
+        {
+            Entry &entry = _entries[i];
+            if (entry.route && (!oldest || _clock - entry.lastUsed > _clock - oldest->lastUsed))
+                oldest = &entry;
+        }
+        return oldest;
+    }
+
+    // copy route and result into the free entry, false if it does not fit in the budget
+    bool fill(Entry *entry, const char *route, const JsonDocument &result)
+    {
+        size_t length = strlen(route);
+        char *copy = (char *)_allocator.allocate(length + 1);
+        if (!copy)
+            return false;
+        memcpy(copy, route, length + 1);
+        entry->route = copy;
+        return entry->document.set(result) && !entry->document.overflowed();
+    }
+
+    void release(Entry *entry)
+    {
+        entry->document.clear();
+        if (entry->route)
+            _allocator.deallocate(entry->route);
+        entry->route = nullptr;
+    }
+
+    PostgrestBudgetAllocator _allocator;
+    Rule _rules[POSTGREST_CACHE_RULES];
+    size_t _ruleCount;
+    Entry _entries[POSTGREST_CACHE_ENTRIES];
+    uint32_t _clock; // counts stores and hits, for LRU
+    uint32_t _hits;
+    uint32_t _misses;
+    uint32_t _evictions;
+};
+
+#endif // POSTGRESTRESPONSECACHE_H
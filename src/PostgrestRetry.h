@@ -0,0 +1,82 @@
+#ifndef POSTGRESTRETRY_H
+#define POSTGRESTRETRY_H
+#include <Arduino.h>
+
+/**
+ * @brief How often and how fast one kind of failure is retried, see PostgrestRetryPolicy
+ */
+struct PostgrestRetryRule
+{
+    uint8_t retries;     // how often the request is repeated, 0 for never
+    uint32_t firstDelay; // milliseconds before the first repetition, doubled for every further one
+    uint32_t maxDelay;   // upper limit of the delay; a longer Retry-After of the server ends the retries
+};
+
+/**
+ * @brief Retries of failed requests by PostgrestClient, see PostgrestClient::setRetryPolicy().
+ * Failures are told apart because they need different treatment:
+ * - connect: no connection to the host (WiFi, DNS, TCP or TLS). The request was not sent, so
+ *   every request can be repeated.
+ * - timeout: the connection was lost while sending or no response arrived in time. The server
+ *   may have executed the request, so only requests that can safely run twice are repeated.
+ * - server: status 5xx, 408 or 429. Also only repeated if safe; Retry-After is honored.
+ * The delay doubles with every retry, and a random part of up to half of it spreads out devices
+ * that failed at the same time, e.g. during a backend outage.
+ *
+ * Usage:
+ *   PostgrestRetryPolicy retry; // defaults below, members can be changed
+ *   retry.server.retries = 5;
+ *   pgClient.setRetryPolicy(&retry);
+ */
+struct PostgrestRetryPolicy
+{
+    // kind of a failed attempt
+    enum Failure
+    {
+        CONNECT_FAILED,
+        NO_RESPONSE,
+        SERVER_ERROR,
+        NOT_RETRYABLE // rejected request (4xx) or error on the client side
+    };
+
+    PostgrestRetryRule connect;
+    PostgrestRetryRule timeout;
+    PostgrestRetryRule server;
+    uint32_t deadline; // milliseconds for a request including all retries, 0 for no limit
+
+    PostgrestRetryPolicy(uint32_t deadline = 60000)
+        : connect{3, 500, 8000}, timeout{2, 1000, 8000}, server{3, 1000, 30000}, deadline(deadline) {}
+
+    const PostgrestRetryRule &rule(Failure failure) const
+    {
+        if (failure == CONNECT_FAILED)
+            return connect;
+        if (failure == NO_RESPONSE)
+            return timeout;
+        return server;
+    }
+
+    /**
+     * @brief Milliseconds to wait before a retry: exponential backoff with jitter
+     *
+     * @param rule rule of the failure
+     * @param retry number of retries of this kind so far
+     * @param retryAfter milliseconds requested by the server (Retry-After), 0 if none
+     */
+    static uint32_t delay(const PostgrestRetryRule &rule, uint8_t retry, uint32_t retryAfter)
+    {
+        uint32_t backoff = rule.firstDelay;
+        for (uint8_t i = 0; i < retry && backoff < rule.maxDelay; i++)
+            backoff *= 2;
+        if (backoff > rule.maxDelay)
+            backoff = rule.maxDelay;
+        uint32_t half = backoff / 2;
+        uint32_t jitter = (uint32_t)random((long)half + 1);
+        // devices told to come back at the same time should not all come back at once
+        if (retryAfter)
+            return retryAfter + jitter;
+        return backoff - half + jitter;
+    }
+};
+
+#endif // POSTGRESTRETRY_H
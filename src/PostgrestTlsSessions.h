@@ -0,0 +1,123 @@
+#ifndef POSTGRESTTLSSESSIONS_H
+#define POSTGRESTTLSSESSIONS_H
+#include <Arduino.h>
+#include <string.h>
+
+#if defined(ESP8266)
+#include <WiFiClientSecureBearSSL.h>
+#endif
+
+// number of hosts a PostgrestBearSSLSessions keeps a session for (auth and data API host)
+#ifndef POSTGREST_TLS_SESSIONS
+#define POSTGREST_TLS_SESSIONS 2
+#endif
+
+/**
+ * @brief Keeps TLS sessions per host so that later connections resume them: an abbreviated
+ * handshake costs one round trip less and no public key operations, see
+ * PostgrestClient::setTlsSessions(). Implement for the TLS client of your board;
+ * PostgrestBearSSLSessions is the implementation for ESP8266.
+ */
+class PostgrestTlsSessionStore
+{
+public:
+    virtual ~PostgrestTlsSessionStore() {}
+
+    /**
+     * @brief Called before connecting to host: hand the session saved for host to the TLS client,
+     * and have the client save the session of the new connection for the next one
+     */
+    virtual void offer(const char *host) = 0;
+
+    /**
+     * @brief Called after the connection to host was opened
+     *
+     * @return true if the handshake resumed the offered session
+     */
+    virtual bool resumed(const char *host) = 0;
+
+    // forget all sessions
+    virtual void clear() = 0;
+};
+
+#if defined(ESP8266)
+/**
+ * @brief TLS sessions of a BearSSL::WiFiClientSecure (ESP8266), one per host.
+ * BearSSL resumes TLS 1.2 sessions by ID: the server accepts the offered session by echoing it,
+ * a full handshake replaces it. Each session takes about 100 bytes.
+ *
+ * Usage:
+ *   BearSSL::WiFiClientSecure client;
+ *   PostgrestBearSSLSessions sessions(client);
+ *   pgClient.setTlsSessions(&sessions);
+ */
+class PostgrestBearSSLSessions : public PostgrestTlsSessionStore
+{
+public:
+    explicit PostgrestBearSSLSessions(BearSSL::WiFiClientSecure &client) : _client(client), _current(nullptr), _next(0)
+    {
+        clear();
+    }
+
+    void offer(const char *host) override
+    {
+        _current = slotFor(host);
+        memcpy(_offered, &_current->session, sizeof(_offered));
+        _client.setSession(&_current->session); // BearSSL updates it after the handshake
+    }
+
+    bool resumed(const char *host) override
+    {
+        if (!_current || !sameHost(_current->host, host))
+            return false;
+        // an empty session can't be resumed; a resumed one keeps its ID and master secret
+        BearSSL::Session empty;
+        return memcmp(_offered, &empty, sizeof(_offered)) != 0 && memcmp(_offered, &_current->session, sizeof(_offered)) == 0;
+    }
+
+    void clear() override
+    {
+        for (size_t i = 0; i < POSTGREST_TLS_SESSIONS; i++)
+        {
+            _slots[i].host = nullptr;
+            _slots[i].session = BearSSL::Session();
+        }
+        _current = nullptr;
+    }
+
+private:
+    struct Slot
+    {
+        const char *host; // nullptr if unused
+        BearSSL::Session session;
+    };
+
+    static bool sameHost(const char *a, const char *b)
+    {
+        return a == b || (a && b && strcmp(a, b) == 0);
+    }
+
+    // the slot of host, otherwise a new one (replacing sessions in turn)
+    Slot *slotFor(const char *host)
+    {
+        for (size_t i = 0; i < POSTGREST_TLS_SESSIONS; i++)
+        {
+            if (sameHost(_slots[i].host, host))
+                return &_slots[i];
+        }
+        Slot *slot = &_slots[_next];
+        _next = (_next + 1) % POSTGREST_TLS_SESSIONS;
+        slot->host = host;
+        slot->session = BearSSL::Session();
+        return slot;
+    }
+
+    BearSSL::WiFiClientSecure &_client;
+    Slot _slots[POSTGREST_TLS_SESSIONS];
+    Slot *_current; // slot of the last offer()
+    size_t _next;   // slot replaced next
+    uint8_t _offered[sizeof(BearSSL::Session)];
+};
+#endif
+
+#endif // POSTGRESTTLSSESSIONS_H
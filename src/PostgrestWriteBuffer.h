@@ -0,0 +1,217 @@
+#ifndef POSTGRESTWRITEBUFFER_H
+#define POSTGRESTWRITEBUFFER_H
+#include <Arduino.h>
+
+/**
+ * @brief Print adapter that collects a request in a fixed buffer and passes it to the connection
+ * in as few writes as possible: when the buffer is full and on flush().
+ * Many WiFi/TLS stacks turn every write into its own TCP segment or TLS record, so printing a
+ * request header by header costs a packet (and a TLS record overhead) per header.
+ * Writes larger than the buffer are passed through directly after the buffered bytes.
+ */
+template <size_t Size>
+class PostgrestWriteBuffer : public Print
+{
+public:
+    explicit PostgrestWriteBuffer(Print &target) : _target(target), _used(0), _sent(0), _failed(false) {}
+
+    // start a new request: drop buffered bytes and reset the error state
+    void begin()
+    {
+        _used = 0;
+        _sent = 0;
+        _failed = false;
+    }
+
+    size_t write(uint8_t c) override
+    {
+        if (_used == Size && !send())
+            return 0;
+        _buffer[_used++] = c;
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        if (_used + size > Size)
+        {
+            if (!send())
+                return 0;
+            if (size >= Size)
+                return pass(data, size);
+        }
+        memcpy(_buffer + _used, data, size);
+        _used += size;
+        return size;
+    }
+
+    void flush() override
+    {
+        send();
+        _target.flush();
+    }
+
+    /**
+     * @brief true if the connection did not accept all bytes since begin()
+     */
+    bool failed() const
+    {
+        return _failed;
+    }
+
+    // bytes passed to the connection since begin()
+    size_t sent() const
+    {
+        return _sent;
+    }
+
+private:
+    bool send()
+    {
+        size_t used = _used;
+        _used = 0;
+        return used == 0 || pass(_buffer, used) == used;
+    }
+
+    size_t pass(const uint8_t *data, size_t size)
+    {
+        if (_failed)
+            return 0;
+        size_t written = _target.write(data, size);
+        _sent += written;
+        if (written != size)
+            _failed = true;
+        return written;
+    }
+
+    Print &_target;
+    size_t _used;
+    size_t _sent;
+    bool _failed;
+    uint8_t _buffer[Size];
+};
+
+/**
+ * @brief Print into a char array, null terminated and truncated to its capacity.
+ * length() counts all printed bytes, so printing to a PostgrestCharPrint without array
+ * measures the output.
+ */
+class PostgrestCharPrint : public Print
+{
+public:
+    PostgrestCharPrint(char *buffer, size_t capacity) : _buffer(buffer), _capacity(capacity), _length(0)
+    {
+        if (_buffer && _capacity)
+            _buffer[0] = '\0';
+    }
+
+    size_t write(uint8_t c) override
+    {
+        if (_buffer && _length + 1 < _capacity)
+        {
+            _buffer[_length] = (char)c;
+            _buffer[_length + 1] = '\0';
+        }
+        _length++;
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        if (_buffer && _length + 1 < _capacity)
+        {
+            size_t n = _capacity - 1 - _length;
+            if (n > size)
+                n = size;
+            memcpy(_buffer + _length, data, n);
+            _buffer[_length + n] = '\0';
+        }
+        _length += size;
+        return size;
+    }
+
+    size_t length() const
+    {
+        return _length;
+    }
+
+private:
+    char *_buffer;
+    size_t _capacity;
+    size_t _length;
+};
+
+/**
+ * @brief Print adapter that sends a request body with "Transfer-Encoding: chunked", for bodies
+ * whose length is not known in advance. Bytes are collected in a buffer of Size bytes and
+ * passed on as one chunk each time it is full; finish() sends the last chunk and the
+ * terminating empty chunk.
+ */
+template <size_t Size>
+class PostgrestChunkedPrint : public Print
+{
+public:
+    explicit PostgrestChunkedPrint(Print &target) : _target(target), _used(0), _length(0) {}
+
+    size_t write(uint8_t c) override
+    {
+        if (_used == Size)
+            sendChunk();
+        _buffer[_used++] = c;
+        _length++;
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        for (size_t done = 0; done < size;)
+        {
+            if (_used == Size)
+                sendChunk();
+            size_t n = Size - _used < size - done ? Size - _used : size - done;
+            memcpy(_buffer + _used, data + done, n);
+            _used += n;
+            done += n;
+        }
+        _length += size;
+        return size;
+    }
+
+    // send the buffered bytes and the end of the body
+    void finish()
+    {
+        sendChunk();
+        _target.print("0\r\n\r\n");
+    }
+
+    // payload bytes written, without chunk framing
+    size_t length() const
+    {
+        return _length;
+    }
+
+private:
+    void sendChunk()
+    {
+        if (_used == 0)
+            return;
+        static const char hex[] = "0123456789abcdef";
+        char size[12];
+        int pos = sizeof(size);
+        size[--pos] = '\n';
+        size[--pos] = '\r';
+        for (size_t n = _used; n > 0 || pos == (int)sizeof(size) - 2; n >>= 4)
+            size[--pos] = hex[n & 0x0f];
+        _target.write((const uint8_t *)size + pos, sizeof(size) - pos);
+        _target.write(_buffer, _used);
+        _target.print("\r\n");
+        _used = 0;
+    }
+
+    Print &_target;
+    size_t _used;
+    size_t _length;
+    uint8_t _buffer[Size];
+};
+
+#endif // POSTGRESTWRITEBUFFER_H